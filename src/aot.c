@@ -0,0 +1,555 @@
+// chip8aot: translates a ROM ahead of time into C code driving a Chip8
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip.h"
+
+typedef struct Translation
+{
+    bool reachable[RAM_CAPACITY]; // Instruction starts found by the static walk
+    bool code[RAM_CAPACITY];      // Bytes belonging to translated instructions
+    uint8_t quirks;               // Quirk profile baked into the generated code
+} Translation;
+
+static uint16_t read_opcode(const Chip8* chip8, uint16_t pc)
+{
+    return (chip8->ram[pc] << 8) | (chip8->ram[(pc + 1) % RAM_CAPACITY]);
+}
+
+static uint16_t instruction_length(uint16_t opcode)
+{
+    // F000 NNNN carries its address in a second word
+    return opcode == 0xF000 ? 4 : 2;
+}
+
+static bool is_skip(uint16_t opcode)
+{
+    switch (opcode >> 12) {
+    case 0x03:
+    case 0x04:
+    case 0x09:
+        return true;
+
+    case 0x05:
+        return (opcode & 0x0F) != 0x2 && (opcode & 0x0F) != 0x3;
+
+    case 0x0E:
+        return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+
+    default:
+        return false;
+    }
+}
+
+static void walk(const Chip8* chip8, Translation* t)
+{
+    // Follow every statically known control flow edge from the entry point
+    static uint16_t worklist[RAM_CAPACITY];
+    size_t pending = 0;
+
+    worklist[pending++] = CHIP_ENTRY_POINT;
+
+    while (pending > 0) {
+        const uint16_t pc = worklist[--pending];
+
+        if (pc + 1 >= RAM_CAPACITY || t->reachable[pc]) {
+            continue;
+        }
+
+        const uint16_t opcode = read_opcode(chip8, pc);
+        const uint16_t length = instruction_length(opcode);
+        t->reachable[pc] = true;
+
+        for (uint16_t i = 0; i < length; ++i) {
+            t->code[(pc + i) % RAM_CAPACITY] = true;
+        }
+
+        switch (opcode >> 12) {
+        case 0x01:
+            worklist[pending++] = opcode & 0x0FFF;
+            break;
+
+        case 0x02:
+            worklist[pending++] = opcode & 0x0FFF;
+            worklist[pending++] = pc + 2;
+            break;
+
+        case 0x0B:
+            // Indirect jump, the target is only known at runtime
+            break;
+
+        default:
+            if (opcode == 0x00EE || opcode == 0x00FD) {
+                break; // Return address is only known at runtime, or exited
+            }
+
+            worklist[pending++] = pc + length;
+
+            if (is_skip(opcode)) {
+                worklist[pending++] = pc + 2 + instruction_length(read_opcode(chip8, pc + 2));
+            }
+            break;
+        }
+    }
+}
+
+static void emit_goto_indented(FILE* out, const Translation* t, uint16_t target, const char* indent)
+{
+    if (t->reachable[target]) {
+        fprintf(out, "%sgoto L_%03X;\n", indent, target);
+    } else {
+        fprintf(out, "%schip8->PC = 0x%03X;\n", indent, target);
+        fprintf(out, "%sgoto dispatch;\n", indent);
+    }
+}
+
+static void emit_goto(FILE* out, const Translation* t, uint16_t target)
+{
+    emit_goto_indented(out, t, target, "    ");
+}
+
+static void emit_skip(FILE* out, const Chip8* chip8, const Translation* t, uint16_t pc,
+    const char* condition)
+{
+    const uint16_t skipped = pc + 2 + instruction_length(read_opcode(chip8, pc + 2));
+
+    fprintf(out, "    if (%s) {\n", condition);
+    emit_goto_indented(out, t, skipped, "        ");
+    fprintf(out, "    }\n");
+    emit_goto(out, t, pc + 2);
+}
+
+static void emit_interpret(FILE* out, const Translation* t, uint16_t pc, bool static_next)
+{
+    // Hand the instruction to the interpreter
+    fprintf(out, "    chip8->PC = 0x%03X;\n", pc);
+    fprintf(out, "    chip8_execute(chip8);\n");
+
+    if (static_next) {
+        emit_goto(out, t, pc + 2);
+    } else {
+        fprintf(out, "    goto dispatch;\n");
+    }
+}
+
+static void emit_store(FILE* out, const Translation* t, uint16_t pc, const char* length)
+{
+    // RAM store through the interpreter, leave if it overwrote translated code
+    fprintf(out, "    store_address = chip8->I;\n");
+    fprintf(out, "    chip8->PC = 0x%03X;\n", pc);
+    fprintf(out, "    chip8_execute(chip8);\n");
+    fprintf(out, "    if (hits_code(store_address, %s)) {\n", length);
+    fprintf(out, "        *code_modified = true;\n");
+    fprintf(out, "        return executed;\n");
+    fprintf(out, "    }\n");
+    emit_goto(out, t, pc + 2);
+}
+
+static void emit_alu(FILE* out, uint8_t quirks, uint8_t x, uint8_t y, uint8_t n)
+{
+    // Source register of the shifts
+    const uint8_t shift = (quirks & QUIRK_SHIFT_VY) ? y : x;
+
+    switch (n) {
+    case 0x0:
+        fprintf(out, "    V[0x%X] = V[0x%X];\n", x, y);
+        break;
+
+    case 0x1:
+    case 0x2:
+    case 0x3:
+        fprintf(out, "    V[0x%X] %c= V[0x%X];\n", x, n == 0x1 ? '|' : n == 0x2 ? '&' : '^', y);
+        if (quirks & QUIRK_VF_RESET) {
+            fprintf(out, "    V[0xF] = 0;\n");
+        }
+        break;
+
+    case 0x4:
+        fprintf(out, "    flag = ((uint16_t)(V[0x%X] + V[0x%X]) > 255);\n", x, y);
+        fprintf(out, "    V[0x%X] += V[0x%X];\n", x, y);
+        fprintf(out, "    V[0xF] = flag;\n");
+        break;
+
+    case 0x5:
+        fprintf(out, "    flag = (V[0x%X] <= V[0x%X]);\n", y, x);
+        fprintf(out, "    V[0x%X] -= V[0x%X];\n", x, y);
+        fprintf(out, "    V[0xF] = flag;\n");
+        break;
+
+    case 0x6:
+        fprintf(out, "    flag = V[0x%X] & 1;\n", shift);
+        fprintf(out, "    V[0x%X] = V[0x%X] >> 1;\n", x, shift);
+        fprintf(out, "    V[0xF] = flag;\n");
+        break;
+
+    case 0x7:
+        fprintf(out, "    flag = (V[0x%X] <= V[0x%X]);\n", x, y);
+        fprintf(out, "    V[0x%X] = V[0x%X] - V[0x%X];\n", x, y, x);
+        fprintf(out, "    V[0xF] = flag;\n");
+        break;
+
+    case 0xE:
+        fprintf(out, "    flag = (V[0x%X] & 0x80) >> 7;\n", shift);
+        fprintf(out, "    V[0x%X] = V[0x%X] << 1;\n", x, shift);
+        fprintf(out, "    V[0xF] = flag;\n");
+        break;
+
+    default:
+        break; // Not implemented or bad opcode
+    }
+}
+
+static void emit_instruction(FILE* out, const Chip8* chip8, const Translation* t, uint16_t pc,
+    uint16_t opcode)
+{
+    const uint16_t NNN = opcode & 0x0FFF;
+    const uint8_t NN = opcode & 0x0FF;
+    const uint8_t X = (opcode >> 8) & 0x0F;
+    const uint8_t Y = (opcode >> 4) & 0x0F;
+    char condition[64];
+
+    fprintf(out, "L_%03X: // %04X\n", pc, opcode);
+    fprintf(out, "    if (executed == count) {\n");
+    fprintf(out, "        chip8->PC = 0x%03X;\n", pc);
+    fprintf(out, "        return executed;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    executed++;\n");
+
+    switch (opcode >> 12) {
+    case 0x00:
+        if (opcode == 0x00EE) {
+            fprintf(out, "    chip8->PC = *--chip8->stack_ptr;\n");
+            fprintf(out, "    goto dispatch;\n");
+        } else if (opcode == 0x00FD) {
+            emit_interpret(out, t, pc, false);
+        } else {
+            emit_interpret(out, t, pc, true); // Display opcodes, 0NNN does nothing
+        }
+        break;
+
+    case 0x01:
+        emit_goto(out, t, NNN);
+        break;
+
+    case 0x02:
+        fprintf(out, "    *chip8->stack_ptr++ = 0x%03X;\n", pc + 2);
+        emit_goto(out, t, NNN);
+        break;
+
+    case 0x03:
+    case 0x04:
+        snprintf(condition, sizeof(condition), "V[0x%X] %s 0x%02X",
+            X, (opcode >> 12) == 0x03 ? "==" : "!=", NN);
+        emit_skip(out, chip8, t, pc, condition);
+        break;
+
+    case 0x05:
+        if ((opcode & 0x0F) == 0x2) {
+            char length[8];
+            snprintf(length, sizeof(length), "%u", (X <= Y ? Y - X : X - Y) + 1);
+            emit_store(out, t, pc, length);
+            break;
+        }
+
+        if ((opcode & 0x0F) == 0x3) {
+            emit_interpret(out, t, pc, true);
+            break;
+        }
+
+        // 5XY0 shares the compare with 9XY0
+        // Fall through
+    case 0x09:
+        snprintf(condition, sizeof(condition), "V[0x%X] %s V[0x%X]",
+            X, (opcode >> 12) == 0x05 ? "==" : "!=", Y);
+        emit_skip(out, chip8, t, pc, condition);
+        break;
+
+    case 0x06:
+        fprintf(out, "    V[0x%X] = 0x%02X;\n", X, NN);
+        emit_goto(out, t, pc + 2);
+        break;
+
+    case 0x07:
+        fprintf(out, "    V[0x%X] += 0x%02X;\n", X, NN);
+        emit_goto(out, t, pc + 2);
+        break;
+
+    case 0x08:
+        emit_alu(out, t->quirks, X, Y, opcode & 0x0F);
+        emit_goto(out, t, pc + 2);
+        break;
+
+    case 0x0A:
+        fprintf(out, "    chip8->I = 0x%03X;\n", NNN);
+        emit_goto(out, t, pc + 2);
+        break;
+
+    case 0x0B:
+        fprintf(out, "    chip8->PC = 0x%03X + V[0];\n", NNN);
+        fprintf(out, "    goto dispatch;\n");
+        break;
+
+    case 0x0E:
+        if (NN == 0x9E || NN == 0xA1) {
+            snprintf(condition, sizeof(condition), "%schip8->keypad[V[0x%X]]",
+                NN == 0x9E ? "" : "!", X);
+            emit_skip(out, chip8, t, pc, condition);
+        } else {
+            emit_goto(out, t, pc + 2);
+        }
+        break;
+
+    case 0x0F:
+        switch (NN) {
+        case 0x00:
+            if (opcode == 0xF000) {
+                fprintf(out, "    chip8->I = 0x%04X;\n", read_opcode(chip8, pc + 2));
+                emit_goto(out, t, pc + 4);
+            } else {
+                emit_goto(out, t, pc + 2);
+            }
+            break;
+
+        case 0x07:
+            fprintf(out, "    V[0x%X] = chip8->delay_timer;\n", X);
+            emit_goto(out, t, pc + 2);
+            break;
+
+        case 0x0A:
+            emit_interpret(out, t, pc, false);
+            break;
+
+        case 0x15:
+            fprintf(out, "    chip8->delay_timer = V[0x%X];\n", X);
+            emit_goto(out, t, pc + 2);
+            break;
+
+        case 0x18:
+            // Leave after turning the tone on or off, as chip8_step does
+            fprintf(out, "    if ((chip8->sound_timer > 0) != (V[0x%X] > 0)) {\n", X);
+            fprintf(out, "        chip8->sound_timer = V[0x%X];\n", X);
+            fprintf(out, "        chip8->sound_edge = true;\n");
+            fprintf(out, "        chip8->PC = 0x%03X;\n", pc + 2);
+            fprintf(out, "        return executed;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "    chip8->sound_timer = V[0x%X];\n", X);
+            emit_goto(out, t, pc + 2);
+            break;
+
+        case 0x1E:
+            fprintf(out, "    chip8->I += V[0x%X];\n", X);
+            if (t->quirks & QUIRK_FX1E_OVERFLOW) {
+                fprintf(out, "    V[0xF] = chip8->I > 0xFFF;\n");
+            }
+            emit_goto(out, t, pc + 2);
+            break;
+
+        case 0x29:
+            fprintf(out, "    chip8->I = V[0x%X] * 5;\n", X);
+            emit_goto(out, t, pc + 2);
+            break;
+
+        case 0x33:
+            emit_store(out, t, pc, "3");
+            break;
+
+        case 0x55: {
+            char length[8];
+            snprintf(length, sizeof(length), "%u", X + 1);
+            emit_store(out, t, pc, length);
+            break;
+        }
+
+        default:
+            emit_interpret(out, t, pc, true);
+            break;
+        }
+        break;
+
+    default:
+        // CXNN and DXYN
+        emit_interpret(out, t, pc, true);
+        break;
+    }
+
+    fprintf(out, "\n");
+}
+
+static void emit_translation(FILE* out, const Chip8* chip8, const Translation* t,
+    const char* rom_path, long rom_size)
+{
+    fprintf(out, "// Generated by chip8aot from \"%s\", do not edit\n\n", rom_path);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    fprintf(out, "#include <string.h>\n\n");
+
+    // Image of the translated ROM
+    fprintf(out, "static const uint8_t g_rom[%ld] = {", rom_size > 0 ? rom_size : 1);
+    for (long i = 0; i < rom_size; ++i) {
+        fprintf(out, "%s0x%02X,", i % 12 == 0 ? "\n    " : " ", chip8->ram[CHIP_ENTRY_POINT + i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    // Bytes covered by translated instructions
+    fprintf(out, "static const uint8_t g_code_map[RAM_CAPACITY / 8] = {");
+    for (size_t i = 0; i < RAM_CAPACITY / 8; ++i) {
+        uint8_t bits = 0;
+        for (size_t j = 0; j < 8; ++j) {
+            bits |= t->code[i * 8 + j] << j;
+        }
+        fprintf(out, "%s0x%02X,", i % 12 == 0 ? "\n    " : " ", bits);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out,
+        "bool chip8_aot_matches(const Chip8* chip8)\n"
+        "{\n"
+        "    return chip8->quirks == 0x%02X &&\n"
+        "        memcmp(&chip8->ram[CHIP_ENTRY_POINT], g_rom, %ld) == 0;\n"
+        "}\n\n", t->quirks, rom_size);
+
+    fprintf(out,
+        "static bool hits_code(uint16_t address, uint16_t length)\n"
+        "{\n"
+        "    for (uint16_t i = 0; i < length; ++i) {\n"
+        "        const uint16_t byte = (address + i) %% RAM_CAPACITY;\n"
+        "        if (g_code_map[byte / 8] & (1 << (byte %% 8))) {\n"
+        "            return true;\n"
+        "        }\n"
+        "    }\n"
+        "    return false;\n"
+        "}\n\n");
+
+    fprintf(out,
+        "static bool interpret(Chip8* chip8)\n"
+        "{\n"
+        "    // Untranslated instruction, returns true if it stored into translated code\n"
+        "    const uint16_t pc = chip8->PC %% RAM_CAPACITY;\n"
+        "    const uint16_t opcode = (chip8->ram[pc] << 8) | chip8->ram[(pc + 1) %% RAM_CAPACITY];\n"
+        "    const uint16_t address = chip8->I;\n"
+        "\n"
+        "    chip8_execute(chip8);\n"
+        "\n"
+        "    if ((opcode & 0xF0FF) == 0xF033) {\n"
+        "        return hits_code(address, 3);\n"
+        "    }\n"
+        "    if ((opcode & 0xF0FF) == 0xF055) {\n"
+        "        return hits_code(address, ((opcode >> 8) & 0x0F) + 1);\n"
+        "    }\n"
+        "    if ((opcode & 0xF00F) == 0x5002) {\n"
+        "        const uint8_t x = (opcode >> 8) & 0x0F;\n"
+        "        const uint8_t y = (opcode >> 4) & 0x0F;\n"
+        "        return hits_code(address, (x <= y ? y - x : x - y) + 1);\n"
+        "    }\n"
+        "    return false;\n"
+        "}\n\n");
+
+    fprintf(out,
+        "uint32_t chip8_aot_run(Chip8* chip8, uint32_t count, bool* code_modified)\n"
+        "{\n"
+        "    uint8_t* V = chip8->V;\n"
+        "    uint32_t executed = 0;\n"
+        "    uint16_t store_address;\n"
+        "    uint8_t flag;\n"
+        "\n"
+        "    (void)store_address;\n"
+        "    (void)flag;\n"
+        "    chip8->sound_edge = false;\n"
+
+        "\n"
+        "dispatch:\n"
+        "    if (executed == count) {\n"
+        "        return executed;\n"
+        "    }\n"
+        "\n"
+        "    switch (chip8->PC) {\n");
+
+    for (uint32_t pc = 0; pc < RAM_CAPACITY; ++pc) {
+        if (t->reachable[pc]) {
+            fprintf(out, "    case 0x%03X: goto L_%03X;\n", pc, pc);
+        }
+    }
+
+    fprintf(out,
+        "    default:\n"
+        "        // Not found by the static walk, interpret it\n"
+        "        executed++;\n"
+        "        if (interpret(chip8)) {\n"
+        "            *code_modified = true;\n"
+        "            return executed;\n"
+        "        }\n"
+        "        if (chip8->sound_edge) {\n"
+        "            return executed;\n"
+        "        }\n"
+        "        goto dispatch;\n"
+        "    }\n\n");
+
+    for (uint32_t pc = 0; pc < RAM_CAPACITY; ++pc) {
+        if (t->reachable[pc]) {
+            emit_instruction(out, chip8, t, pc, read_opcode(chip8, pc));
+        }
+    }
+
+    fprintf(out, "    return executed;\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    static Chip8 chip8;
+    static Translation translation;
+
+    const char* rom_path = NULL;
+    const char* output_path = NULL;
+    translation.quirks = QUIRKS_CHIP8;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+            if (!chip8_quirks_from_name(argv[++i], &translation.quirks)) {
+                fprintf(stderr, "ERROR: Unknown quirk profile \"%s\"\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (!rom_path) {
+            rom_path = argv[i];
+        } else {
+            output_path = argv[i];
+        }
+    }
+
+    if (!rom_path || !output_path) {
+        fprintf(stderr, "Usage: chip8aot [--quirks chip8|schip|amiga|xochip] <rom file> <output c file>\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!chip8_init(&chip8, rom_path, translation.quirks)) {
+        fprintf(stderr, "ERROR: Could not load ROM\n");
+        return EXIT_FAILURE;
+    }
+
+    // Size of the ROM image, trailing zero bytes are indistinguishable from free RAM
+    long rom_size = MAX_ROM_SIZE;
+    while (rom_size > 0 && chip8.ram[CHIP_ENTRY_POINT + rom_size - 1] == 0) {
+        rom_size--;
+    }
+
+    walk(&chip8, &translation);
+
+    FILE* out = fopen(output_path, "w");
+
+    if (!out) {
+        fprintf(stderr, "ERROR: Could not open output file \"%s\"\n", output_path);
+        return EXIT_FAILURE;
+    }
+
+    emit_translation(out, &chip8, &translation, rom_path, rom_size);
+    fclose(out);
+
+    size_t translated = 0;
+    for (size_t i = 0; i < RAM_CAPACITY; ++i) {
+        translated += translation.reachable[i];
+    }
+
+    printf("INFO: Translated %zu instructions into \"%s\"\n", translated, output_path);
+
+    return EXIT_SUCCESS;
+}
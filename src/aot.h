@@ -0,0 +1,18 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip.h"
+
+// Implemented by the C file chip8aot generates from a ROM
+
+// Check that the loaded ROM is the one that was translated
+bool chip8_aot_matches(const Chip8* chip8);
+
+// Run up to count instructions, code_modified is set when a RAM store
+//   hits translated code and the caller must switch to the interpreter
+uint32_t chip8_aot_run(Chip8* chip8, uint32_t count, bool* code_modified);
+
+#endif // _AOT_H_
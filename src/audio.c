@@ -1,15 +1,24 @@
 #include "audio.h"
 
-bool audio_init(Audio* audio)
+#include <stdio.h>
+#include <string.h>
+
+bool audio_init(Audio* audio, uint16_t samples)
 {
     audio->volume = AUDIO_VOLUME;
     audio->wave_freq = AUDIO_WAVE_FREQUENCY;
+    audio->wave_phase = 0;
+    audio->playing = false;
+    atomic_init(&audio->head, 0);
+    atomic_init(&audio->tail, 0);
+    atomic_init(&audio->underruns, 0);
+    atomic_init(&audio->overruns, 0);
 
     audio->want = (SDL_AudioSpec){
         .freq = AUDIO_FREQUENCY,
         .format = AUDIO_FORMAT,
         .channels = AUDIO_CHANNELS,
-        .samples = AUDIO_SAMPLES,
+        .samples = samples,
         .callback = audio_callback,
         .userdata = audio
     };
@@ -27,29 +36,90 @@ bool audio_init(Audio* audio)
         return false;
     }
 
+    // The device runs until cleanup, silence is queued as samples
+    SDL_PauseAudioDevice(audio->device, 0);
+
     return true;
 }
 
-void audio_cleanup(Audio audio)
+void audio_cleanup(const Audio* audio)
 {
-    SDL_CloseAudioDevice(audio.device);
+    SDL_CloseAudioDevice(audio->device);
+
+    const uint32_t underruns = atomic_load(&audio->underruns);
+    const uint32_t overruns = atomic_load(&audio->overruns);
+
+    if (underruns || overruns) {
+        printf("INFO: Audio ran dry %u times and dropped samples %u times\n", underruns, overruns);
+    }
 }
 
-void audio_callback(void* userdata, uint8_t* stream, int len)
+void audio_push(Audio* audio, uint32_t count, bool tone)
 {
-    Audio* config = (Audio*)userdata;
+    // Producer side, count samples of the square wave or of silence
+    const uint32_t tail = atomic_load_explicit(&audio->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+    const uint32_t space = AUDIO_RING_SIZE - (head - tail);
+    const uint32_t period = audio->have.freq / audio->wave_freq;
+
+    if (count > space) {
+        // The wave keeps its phase across the dropped samples
+        audio->wave_phase = (audio->wave_phase + count - space) % period;
+        atomic_fetch_add_explicit(&audio->overruns, 1, memory_order_relaxed);
+        count = space;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        int16_t sample = 0;
+
+        if (tone) {
+            sample = audio->wave_phase < period / 2 ? -audio->volume : audio->volume;
+        }
+
+        audio->ring[head++ % AUDIO_RING_SIZE] = sample;
+        audio->wave_phase = (audio->wave_phase + 1) % period;
+    }
+
+    atomic_store_explicit(&audio->head, head, memory_order_release);
+}
 
+void audio_callback(void* userdata, uint8_t* stream, int len)
+{
+    // Consumer side on the SDL audio thread, never waits for the producer
+    Audio* audio = (Audio*)userdata;
     int16_t* audio_buffer = (int16_t*)stream;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = config->have.freq / config->wave_freq;
-    const int32_t half_square_wave_period = square_wave_period / 2;
 
     // We are filling 2 bytes at a time, len is in bytes
     //   so divide by 2
-    for (int i = 0; i < len / 2; ++i) {
-        audio_buffer[i] = ((running_sample_index++ / half_square_wave_period) % 2) ?
-            config->volume :
-            -config->volume;
+    const uint32_t wanted = len / 2;
+    const uint32_t head = atomic_load_explicit(&audio->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+    const uint32_t available = head - tail;
+
+    // Start, or start again after running dry, only once enough is queued
+    //  that the producer's once a frame pushes keep up
+    if (!audio->playing && available >= AUDIO_PRIME_SAMPLES + wanted) {
+        audio->playing = true;
     }
-}
 
+    uint32_t count = 0;
+
+    if (audio->playing) {
+        count = available < wanted ? available : wanted;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            audio_buffer[i] = audio->ring[tail++ % AUDIO_RING_SIZE];
+        }
+
+        atomic_store_explicit(&audio->tail, tail, memory_order_release);
+    }
+
+    if (count < wanted) {
+        memset(&audio_buffer[count], 0, (wanted - count) * sizeof(int16_t));
+
+        if (audio->playing) {
+            audio->playing = false;
+            atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+        }
+    }
+}
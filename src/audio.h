@@ -3,11 +3,16 @@
 
 #include <SDL2/SDL.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #define AUDIO_FREQUENCY 44100
 #define AUDIO_FORMAT AUDIO_S16LSB
 #define AUDIO_CHANNELS 1
-#define AUDIO_SAMPLES 512
+#define AUDIO_SAMPLES 256        // Default device buffer, in samples
+#define AUDIO_MAX_SAMPLES 4096
+
+#define AUDIO_RING_SIZE 8192     // Queued samples, a power of two
+#define AUDIO_PRIME_SAMPLES 1470 // Two frames queued before playback starts
 
 #define AUDIO_VOLUME 2000 // INT16
 #define AUDIO_WAVE_FREQUENCY 440
@@ -18,11 +23,23 @@ typedef struct Audio {
 
     int16_t volume;
     uint32_t wave_freq;
+
+    // Single producer, single consumer ring of samples. The emulation
+    //  thread only stores head, the audio callback only stores tail
+    int16_t ring[AUDIO_RING_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+
+    uint32_t wave_phase; // Producer, samples into the current wave period
+    bool playing;        // Callback, the ring was primed and has not run dry since
+
+    atomic_uint underruns; // Times the callback ran out of samples
+    atomic_uint overruns;  // Times samples were dropped on a full ring
 } Audio;
 
-bool audio_init(Audio* audio);
-void audio_cleanup(Audio audio);
+bool audio_init(Audio* audio, uint16_t samples);
+void audio_cleanup(const Audio* audio);
+void audio_push(Audio* audio, uint32_t count, bool tone);
 void audio_callback(void* userdata, uint8_t* stream, int len);
 
 #endif // _AUDIO_H_
-
@@ -0,0 +1,302 @@
+#define _DEFAULT_SOURCE // _SC_NPROCESSORS_ONLN
+
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "chip.h"
+#include "jit.h"
+
+typedef struct BatchContext
+{
+    BatchConfig config;
+    Library library;       // Every ROM read once before the workers start
+    BatchJob* jobs;
+    size_t job_count;
+    atomic_size_t next_job; // Index of the next job to hand out
+} BatchContext;
+
+static double seconds_now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t batch_core_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+static BatchJob* batch_new_job(BatchContext* ctx, size_t* capacity, const char* rom_file,
+    size_t length, uint64_t seed)
+{
+    if (ctx->job_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        ctx->jobs = realloc(ctx->jobs, *capacity * sizeof(BatchJob));
+    }
+
+    BatchJob* job = &ctx->jobs[ctx->job_count++];
+    memset(job, 0, sizeof(BatchJob));
+    job->rom_file = malloc(length + 1);
+    memcpy(job->rom_file, rom_file, length);
+    job->rom_file[length] = '\0';
+    job->seed = seed;
+
+    return job;
+}
+
+static bool batch_load_collection(BatchContext* ctx)
+{
+    // One job per ROM of a directory or archive, all with the same seed
+    if (!library_open(&ctx->library, ctx->config.list_file)) {
+        return false;
+    }
+
+    size_t capacity = 0;
+
+    for (uint32_t i = 0; i < ctx->library.count; ++i) {
+        const char* name = library_name(&ctx->library, i);
+        BatchJob* job = batch_new_job(ctx, &capacity, name, strlen(name), ctx->config.seed);
+        job->rom = i;
+        job->loaded = true;
+    }
+
+    return true;
+}
+
+static bool batch_load_jobs(BatchContext* ctx)
+{
+    if (library_is_collection(ctx->config.list_file)) {
+        return batch_load_collection(ctx);
+    }
+
+    FILE* list = fopen(ctx->config.list_file, "r");
+
+    if (!list) {
+        fprintf(stderr, "ERROR: Could not open batch list \"%s\"\n", ctx->config.list_file);
+        return false;
+    }
+
+    char line[4096];
+    size_t capacity = 0;
+
+    while (fgets(line, sizeof(line), list)) {
+        // Trim trailing whitespace, skip blank lines and comments
+        size_t length = strlen(line);
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' ||
+            line[length - 1] == ' ' || line[length - 1] == '\t')) {
+            line[--length] = '\0';
+        }
+
+        if (length == 0 || line[0] == '#') {
+            continue;
+        }
+
+        // A trailing number separated by whitespace is the job's seed
+        uint64_t seed = ctx->config.seed;
+        char* separator = strrchr(line, ' ');
+        char* tab = strrchr(line, '\t');
+        if (!separator || (tab && tab > separator)) {
+            separator = tab;
+        }
+
+        if (separator) {
+            char* end;
+            const unsigned long long value = strtoull(separator + 1, &end, 0);
+
+            if (end != separator + 1 && *end == '\0') {
+                seed = value;
+                while (separator > line && (separator[-1] == ' ' || separator[-1] == '\t')) {
+                    --separator;
+                }
+                *separator = '\0';
+                length = separator - line;
+            }
+        }
+
+        // Read now, a ROM that cannot be read fails only its own job
+        BatchJob* job = batch_new_job(ctx, &capacity, line, length, seed);
+        job->rom = ctx->library.count;
+        job->loaded = library_add_file(&ctx->library, job->rom_file);
+    }
+
+    fclose(list);
+    return true;
+}
+
+static void batch_run_job(const BatchContext* ctx, BatchJob* job, Chip8* chip8, Jit* jit)
+{
+    const double start = seconds_now();
+
+    if (!job->loaded) {
+        job->ok = false;
+        return;
+    }
+
+    const RomImage* rom = &ctx->library.roms[job->rom];
+    RomProfile profile;
+    job->known = romdb_lookup(ctx->config.db, rom->hash, &profile);
+
+    const uint8_t quirks = ctx->config.quirks_given ? ctx->config.quirks : profile.quirks;
+    const uint16_t ips = ctx->config.ips ? ctx->config.ips : profile.ips;
+
+    if (!chip8_init_rom(chip8, library_image(&ctx->library, job->rom), rom->size, quirks)) {
+        job->ok = false;
+        return;
+    }
+
+    chip8_seed(chip8, job->seed);
+
+    // A ROM that cannot run at its speed would report hashes for another clock
+    if (!chip8_set_speed(chip8, ips)) {
+        job->ok = false;
+        return;
+    }
+
+    if (jit) {
+        jit_flush(jit);
+    }
+
+    uint64_t instructions = 0;
+
+    for (uint64_t frame = 0; frame < ctx->config.frames; ++frame) {
+        // A frame runs up to and including the instruction its timer tick lands on
+        const uint32_t count = chip8_instructions_to_tick(chip8);
+
+        // Steps end early where FX18 switches the tone, there is no audio
+        for (uint32_t done = 0; done < count;) {
+            done += jit ? jit_run(jit, chip8, count - done) : chip8_step(chip8, count - done);
+        }
+
+        chip8_advance_clock(chip8, count);
+        chip8_tick_timers(chip8);
+        instructions += count;
+    }
+
+    job->ok = true;
+    job->display_hash = chip8_display_hash(chip8);
+    job->instructions = instructions;
+    job->seconds = seconds_now() - start;
+}
+
+static void* batch_worker(void* arg)
+{
+    BatchContext* ctx = arg;
+
+    // Every worker owns its machine, nothing is shared but the job index
+    Chip8* chip8 = calloc(1, sizeof(Chip8));
+    Jit* jit = NULL;
+
+    if (ctx->config.use_jit) {
+        jit = malloc(sizeof(Jit));
+
+        if (!jit_init(jit)) {
+            free(jit);
+            jit = NULL;
+        }
+    }
+
+    for (;;) {
+        const size_t index = atomic_fetch_add(&ctx->next_job, 1);
+
+        if (index >= ctx->job_count) {
+            break;
+        }
+
+        batch_run_job(ctx, &ctx->jobs[index], chip8, jit);
+    }
+
+    if (jit) {
+        jit_cleanup(jit);
+        free(jit);
+    }
+
+    chip8_cleanup(chip8);
+    free(chip8);
+    return NULL;
+}
+
+bool batch_run(BatchConfig config)
+{
+    BatchContext ctx = { .config = config };
+
+    if (ctx.config.frames == 0) {
+        ctx.config.frames = BATCH_DEFAULT_FRAMES;
+    }
+
+    if (!batch_load_jobs(&ctx)) {
+        library_close(&ctx.library);
+        return false;
+    }
+
+    uint32_t thread_count = config.threads ? config.threads : batch_core_count();
+    if (thread_count > ctx.job_count) {
+        thread_count = ctx.job_count > 0 ? ctx.job_count : 1;
+    }
+
+    atomic_init(&ctx.next_job, 0);
+
+    const double start = seconds_now();
+    pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        pthread_create(&threads[i], NULL, batch_worker, &ctx);
+    }
+
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    const double elapsed = seconds_now() - start;
+
+    // Summary in list order, tab separated
+    bool ok = true;
+    printf("# rom\tseed\tstatus\tdisplay_hash\tinstructions\tseconds\n");
+
+    for (size_t i = 0; i < ctx.job_count; ++i) {
+        const BatchJob* job = &ctx.jobs[i];
+        ok &= job->ok;
+
+        printf("%s\t%llu\t%s\t%016llx\t%llu\t%.6f\n", job->rom_file,
+            (unsigned long long)job->seed, job->ok ? "ok" : "error",
+            (unsigned long long)job->display_hash, (unsigned long long)job->instructions,
+            job->seconds);
+
+        if (job->ok && !job->known) {
+            char text[ROMDB_HASH_SIZE * 2 + 1];
+            romdb_format_hash(ctx.library.roms[job->rom].hash, text);
+            fprintf(stderr, "INFO: \"%s\" is not in the ROM database, ran with defaults: %s\n",
+                job->rom_file, text);
+        }
+
+        free(job->rom_file);
+    }
+
+    fprintf(stderr, "INFO: Ran %zu jobs of %llu frames on %u threads in %.3f s\n",
+        ctx.job_count, (unsigned long long)ctx.config.frames, thread_count, elapsed);
+
+    free(threads);
+    free(ctx.jobs);
+    library_close(&ctx.library);
+
+    return ok;
+}
@@ -0,0 +1,43 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "romdb.h"
+#include "library.h"
+
+#define BATCH_DEFAULT_FRAMES 600 // 10 seconds of emulated time per job
+
+typedef struct BatchConfig
+{
+    const char* list_file; // One ROM path per line, optionally followed by a seed, or
+                           //  a directory or archive whose ROMs all run with seed
+    uint64_t frames;       // Frames emulated per job
+    uint32_t threads;      // Worker threads, 0 uses every core
+    uint64_t seed;         // RNG seed for jobs without their own
+    const RomDb* db;       // Per-ROM quirks and speed
+    uint8_t quirks;        // Used for every job if quirks_given
+    bool quirks_given;
+    uint16_t ips;          // Used for every job if not 0
+    bool use_jit;
+} BatchConfig;
+
+typedef struct BatchJob
+{
+    char* rom_file;
+    uint64_t seed;
+    uint32_t rom;          // Index in the batch's library
+    bool loaded;           // The ROM could be read into the library
+
+    // Filled in by the worker
+    bool ok;
+    bool known;            // Found in the ROM database
+    uint64_t display_hash;
+    uint64_t instructions;
+    double seconds;
+} BatchJob;
+
+bool batch_run(BatchConfig config);
+
+#endif // _BATCH_H_
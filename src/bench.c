@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "emu.h"
+#include "chip.h"
+#include "jit.h"
+
+// chip8bench: throughput of the core and the renderer
+//
+// Every result is one tab separated line "name unit value" in a fixed order,
+//  each value is the best of BENCH_REPEATS runs so results can be diffed
+//  between versions.
+
+#define BENCH_REPEATS 5
+#define BENCH_OP_INSTRUCTIONS 2000000 // Instructions per opcode class run
+#define BENCH_ROM_FRAMES 20000        // Emulated frames per ROM run
+#define BENCH_RENDER_FRAMES 2000      // Frames published and presented per render run
+
+#define BENCH_LOOP_LENGTH 64 // Copies of the measured instruction per loop
+
+typedef struct BenchOp
+{
+    const char* name;
+    uint8_t quirks;
+    uint16_t setup[8];  // Run once, 0 terminated
+    uint16_t body[4];   // Repeated to fill the loop, 0 terminated
+} BenchOp;
+
+typedef struct BenchRom
+{
+    const char* name;
+    const uint16_t* code;
+    size_t length;
+} BenchRom;
+
+// Opcode classes, the loop jumps back once every BENCH_LOOP_LENGTH bodies
+static const BenchOp g_ops[] = {
+    { "alu_8xy4",   QUIRKS_CHIP8, { 0x6003, 0x6105 },         { 0x8014 } },
+    { "alu_8xyn",   QUIRKS_CHIP8, { 0x6003, 0x6105 },         { 0x8011, 0x8124, 0x8015, 0x810E } },
+    { "draw_dxy1",  QUIRKS_CHIP8, { 0x6003, 0x6105, 0xA000 }, { 0xD011 } },
+    { "draw_dxy8",  QUIRKS_CHIP8, { 0x6003, 0x6105, 0xA000 }, { 0xD018 } },
+    { "draw_dxyf",  QUIRKS_CHIP8, { 0x603C, 0x611A, 0xA000 }, { 0xD01F } },
+    { "store_fx55", QUIRKS_SCHIP, { 0xAE00 },                 { 0xFF55 } },
+    { "load_fx65",  QUIRKS_SCHIP, { 0xAE00 },                 { 0xFF65 } },
+    { "bcd_fx33",   QUIRKS_CHIP8, { 0x60E7, 0xAE00 },         { 0xF033 } },
+};
+
+// Test ROMs written for this benchmark, dedicated to the public domain
+
+// Cycles the 16 font digits across the screen, clearing it once full
+static const uint16_t g_rom_sprites[] = {
+    0x00E0, 0x6000, 0x6100, 0x6200, // 200: CLS, X = 0, Y = 0, digit = 0
+    0xF229, 0xD015, 0x7005, 0x7201, // 208: draw digit, X += 5, digit++
+    0x4210, 0x6200, 0x403C, 0x121A, // 210: wrap digit, end of line?
+    0x1208, 0x6000, 0x7106, 0x411E, // 218: next digit / X = 0, Y += 6, last line?
+    0x1200, 0x1208,                 // 220: restart / next digit
+};
+
+// Score counter: BCD conversion and three digits redrawn every step
+static const uint16_t g_rom_score[] = {
+    0x6500, 0xA300, 0xF533, 0xF265, // 200: counter = 0, I = 0x300, BCD, load
+    0x00E0, 0x6320, 0x640C, 0xF029, // 208: CLS, X, Y, hundreds
+    0xD345, 0x7305, 0xF129, 0xD345, // 210: draw, X += 5, tens, draw
+    0x7305, 0xF229, 0xD345, 0x7501, // 218: X += 5, ones, draw, counter++
+    0x1202,                         // 220: loop
+};
+
+// Arithmetic in a subroutine with skips, no drawing
+static const uint16_t g_rom_logic[] = {
+    0x6001, 0x6103, 0x2210, 0x3000, // 200: V0 = 1, V1 = 3, call, skip if V0 == 0
+    0x1204, 0x1200, 0x0000, 0x0000, // 208: loop / restart
+    0x8014, 0x8106, 0x8203, 0x8E21, // 210: subroutine
+    0x8E02, 0x8305, 0x830E, 0x7107,
+    0x9120, 0x6207, 0x00EE,         // 220: skip if V1 != V2, V2 = 7, return
+};
+
+#define BENCH_ROM(name, code) { name, code, sizeof(code) / sizeof(code[0]) }
+
+static const BenchRom g_roms[] = {
+    BENCH_ROM("sprites", g_rom_sprites),
+    BENCH_ROM("score", g_rom_score),
+    BENCH_ROM("logic", g_rom_logic),
+};
+
+static double seconds_now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char* group, const char* name, const char* unit, double value)
+{
+    printf("%s/%s\t%s\t%.3f\n", group, name, unit, value);
+}
+
+static size_t bench_put(uint8_t* rom, size_t at, uint16_t opcode)
+{
+    rom[at] = opcode >> 8;
+    rom[at + 1] = opcode & 0xFF;
+    return at + 2;
+}
+
+static void bench_load_op(Chip8* chip8, const BenchOp* op)
+{
+    uint8_t rom[MAX_ROM_SIZE];
+    size_t length = 0;
+
+    for (size_t i = 0; i < sizeof(op->setup) / sizeof(op->setup[0]) && op->setup[i]; ++i) {
+        length = bench_put(rom, length, op->setup[i]);
+    }
+
+    // The loop starts after the setup and jumps back to itself
+    const uint16_t loop = CHIP_ENTRY_POINT + length;
+
+    for (size_t copy = 0; copy < BENCH_LOOP_LENGTH; ++copy) {
+        for (size_t i = 0; i < sizeof(op->body) / sizeof(op->body[0]) && op->body[i]; ++i) {
+            length = bench_put(rom, length, op->body[i]);
+        }
+    }
+
+    length = bench_put(rom, length, 0x1000 | loop);
+
+    chip8_init_rom(chip8, rom, length, op->quirks);
+    chip8_seed(chip8, 0);
+}
+
+static void bench_load_rom(Chip8* chip8, const BenchRom* bench_rom)
+{
+    uint8_t rom[MAX_ROM_SIZE];
+    size_t length = 0;
+
+    for (size_t i = 0; i < bench_rom->length; ++i) {
+        length = bench_put(rom, length, bench_rom->code[i]);
+    }
+
+    chip8_init_rom(chip8, rom, length, QUIRKS_CHIP8);
+    chip8_seed(chip8, 0);
+}
+
+static void bench_ops(Chip8* chip8)
+{
+    for (size_t i = 0; i < sizeof(g_ops) / sizeof(g_ops[0]); ++i) {
+        double best = 0;
+
+        for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+            bench_load_op(chip8, &g_ops[i]);
+
+            const double start = seconds_now();
+            chip8_step(chip8, BENCH_OP_INSTRUCTIONS);
+            const double elapsed = seconds_now() - start;
+
+            if (repeat == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        bench_report("op", g_ops[i].name, "ns_per_inst", best * 1e9 / BENCH_OP_INSTRUCTIONS);
+    }
+}
+
+static void bench_roms(Chip8* chip8, Jit* jit)
+{
+    for (size_t i = 0; i < sizeof(g_roms) / sizeof(g_roms[0]); ++i) {
+        double best = 0;
+        uint64_t instructions = 0;
+
+        for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+            bench_load_rom(chip8, &g_roms[i]);
+
+            if (jit) {
+                jit_flush(jit);
+            }
+
+            instructions = 0;
+            const double start = seconds_now();
+
+            // Same frame loop as headless runs
+            for (uint32_t frame = 0; frame < BENCH_ROM_FRAMES; ++frame) {
+                const uint32_t count = chip8_instructions_to_tick(chip8);
+
+                for (uint32_t done = 0; done < count;) {
+                    done += jit ? jit_run(jit, chip8, count - done) : chip8_step(chip8, count - done);
+                }
+
+                chip8_advance_clock(chip8, count);
+                chip8_tick_timers(chip8);
+                instructions += count;
+            }
+
+            const double elapsed = seconds_now() - start;
+
+            if (repeat == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        const char* group = jit ? "rom_jit" : "rom";
+        bench_report(group, g_roms[i].name, "ns_per_inst", best * 1e9 / instructions);
+        bench_report(group, g_roms[i].name, "frames_per_s", BENCH_ROM_FRAMES / best);
+    }
+}
+
+static bool bench_render(Emulator* emu)
+{
+    // Offscreen software renderer, no window or video driver needed
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, WINDOW_WIDTH * WINDOW_SCALE,
+        WINDOW_HEIGHT * WINDOW_SCALE, 32, SDL_PIXELFORMAT_RGBA8888);
+
+    if (!surface) {
+        fprintf(stderr, "ERROR: Could not create render surface: %s\n", SDL_GetError());
+        return false;
+    }
+
+    emu->renderer = SDL_CreateSoftwareRenderer(surface);
+    emu->palette[0] = BACKGROUND_COLOR;
+    emu->palette[1] = FOREGROUND_COLOR;
+    emu->palette[2] = PLANE2_COLOR;
+    emu->palette[3] = OVERLAP_COLOR;
+    frame_buffer_init(&emu->frames);
+
+    if (!emu->renderer || !emu_init_textures(emu)) {
+        fprintf(stderr, "ERROR: Could not create software renderer: %s\n", SDL_GetError());
+        SDL_FreeSurface(surface);
+        return false;
+    }
+
+    // Some ROM output on screen so the upload is not all background
+    bench_load_rom(&emu->chip8, &g_roms[0]);
+    chip8_step(&emu->chip8, 1000);
+
+    const char* names[] = { "changed", "unchanged" };
+
+    for (int unchanged = 0; unchanged <= 1; ++unchanged) {
+        double best = 0;
+
+        for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+            const double start = seconds_now();
+
+            for (uint32_t frame = 0; frame < BENCH_RENDER_FRAMES; ++frame) {
+                if (!unchanged) {
+                    emu->chip8.display[0][frame % WINDOW_HEIGHT][0] ^= 1;
+                }
+
+                emu_publish_frame(emu);
+                emu_update_screen(emu);
+            }
+
+            const double elapsed = seconds_now() - start;
+
+            if (repeat == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        bench_report("render", names[unchanged], "us_per_frame", best * 1e6 / BENCH_RENDER_FRAMES);
+        bench_report("render", names[unchanged], "frames_per_s", BENCH_RENDER_FRAMES / best);
+    }
+
+    SDL_DestroyTexture(emu->grid);
+    SDL_DestroyTexture(emu->screen);
+    SDL_DestroyRenderer(emu->renderer);
+    SDL_FreeSurface(surface);
+
+    return true;
+}
+
+int main(void)
+{
+    static Emulator emu;
+    static Jit jit;
+
+    printf("# benchmark\tunit\tvalue\n");
+
+    bench_ops(&emu.chip8);
+    bench_roms(&emu.chip8, NULL);
+
+    if (jit_init(&jit)) {
+        bench_roms(&emu.chip8, &jit);
+        jit_cleanup(&jit);
+    }
+
+    if (!bench_render(&emu)) {
+        return EXIT_FAILURE;
+    }
+
+    SDL_Quit();
+
+    return EXIT_SUCCESS;
+}
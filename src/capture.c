@@ -0,0 +1,293 @@
+#define _DEFAULT_SOURCE // fileno, fdopen, dup
+
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "audio.h"
+
+static int g_stdout_fd = -1; // The real stdout once a stream took it over
+
+bool capture_take_stdout(void)
+{
+    // A stream goes to stdout, INFO lines printed there go to stderr from
+    //  now on. Call before anything is printed
+    if (g_stdout_fd >= 0) {
+        return true;
+    }
+
+    fflush(stdout);
+    g_stdout_fd = dup(fileno(stdout));
+
+    if (g_stdout_fd < 0 || dup2(fileno(stderr), fileno(stdout)) < 0) {
+        fprintf(stderr, "ERROR: Could not take over stdout for capturing\n");
+        return false;
+    }
+
+#ifdef _WIN32
+    _setmode(g_stdout_fd, _O_BINARY);
+#endif
+
+    return true;
+}
+
+static FILE* capture_open_file(const char* path)
+{
+    if (strcmp(path, "-") != 0) {
+        return fopen(path, "wb");
+    }
+
+    return capture_take_stdout() ? fdopen(g_stdout_fd, "wb") : NULL;
+}
+
+static bool capture_open_stream(CaptureStream* stream, const char* path)
+{
+    memset(stream, 0, sizeof(CaptureStream));
+
+    if (!path) {
+        return true;
+    }
+
+    stream->path = path;
+    stream->file = capture_open_file(path);
+    stream->buffer = malloc(CAPTURE_BUFFER_SIZE);
+
+    if (!stream->file || !stream->buffer) {
+        fprintf(stderr, "ERROR: Could not open capture output \"%s\"\n", path);
+        return false;
+    }
+
+    // Whole buffers go straight to the file, no second copy in stdio
+    setvbuf(stream->file, NULL, _IONBF, 0);
+
+    return true;
+}
+
+static void capture_flush(CaptureStream* stream)
+{
+    if (stream->used > 0 && !stream->failed &&
+        fwrite(stream->buffer, stream->used, 1, stream->file) != 1) {
+        fprintf(stderr, "ERROR: Could not write capture output \"%s\"\n", stream->path);
+        stream->failed = true;
+    }
+
+    stream->used = 0;
+}
+
+static uint8_t* capture_reserve(CaptureStream* stream, size_t size)
+{
+    // Room for size bytes at the end of the buffer, filled in place
+    if (stream->used + size > CAPTURE_BUFFER_SIZE) {
+        capture_flush(stream);
+    }
+
+    uint8_t* out = stream->buffer + stream->used;
+    stream->used += size;
+
+    return out;
+}
+
+static void capture_close_stream(CaptureStream* stream)
+{
+    if (stream->file) {
+        capture_flush(stream);
+        fclose(stream->file);
+    }
+
+    free(stream->buffer);
+}
+
+bool capture_format_from_name(const char* name, CaptureFormat* format)
+{
+    if (strcmp(name, "rgba") == 0) {
+        *format = CAPTURE_RGBA;
+    } else if (strcmp(name, "mono") == 0) {
+        *format = CAPTURE_MONO;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool capture_open(Capture* capture, const char* video_path, CaptureFormat format,
+    const char* audio_path)
+{
+    memset(capture, 0, sizeof(Capture));
+    capture->format = format;
+
+    if (video_path && audio_path && strcmp(video_path, "-") == 0 && strcmp(audio_path, "-") == 0) {
+        fprintf(stderr, "ERROR: Video and audio cannot both go to stdout\n");
+        return false;
+    }
+
+    if (!capture_open_stream(&capture->video, video_path) ||
+        !capture_open_stream(&capture->audio, audio_path)) {
+        capture_close_stream(&capture->video);
+        capture_close_stream(&capture->audio);
+        return false;
+    }
+
+    return true;
+}
+
+static void capture_rgba(uint8_t* out, const Chip8* chip8, const uint32_t palette[4])
+{
+    // Palette colors are 0xRRGGBBAA, stored as bytes in that order
+    uint8_t colors[4][4];
+
+    for (int i = 0; i < 4; ++i) {
+        colors[i][0] = palette[i] >> 24;
+        colors[i][1] = palette[i] >> 16;
+        colors[i][2] = palette[i] >> 8;
+        colors[i][3] = palette[i];
+    }
+
+    const int scale = chip8->hires ? 1 : 2;
+    const size_t row_size = CAPTURE_WIDTH * 4;
+
+    for (int y = 0; y < CAPTURE_HEIGHT; y += scale) {
+        const uint64_t* plane1 = chip8->display[0][y / scale];
+        const uint64_t* plane2 = chip8->display[1][y / scale];
+        uint8_t* row = out;
+
+        for (int x = 0; x < CAPTURE_WIDTH; ++x) {
+            const int pixel = x / scale;
+            const int bit = 63 - (pixel & 63);
+            const int word = pixel >> 6;
+            const int color = ((plane1[word] >> bit) & 1) | (((plane2[word] >> bit) & 1) << 1);
+
+            memcpy(out, colors[color], 4);
+            out += 4;
+        }
+
+        // Lo-res rows are shown twice
+        if (scale == 2) {
+            memcpy(out, row, row_size);
+            out += row_size;
+        }
+    }
+}
+
+static uint16_t capture_double_bits(uint8_t bits)
+{
+    // Every bit twice, 0b10 becomes 0b1100
+    uint16_t spread = bits;
+    spread = (spread | spread << 4) & 0x0F0F;
+    spread = (spread | spread << 2) & 0x3333;
+    spread = (spread | spread << 1) & 0x5555;
+
+    return spread | spread << 1;
+}
+
+static void capture_mono(uint8_t* out, const Chip8* chip8)
+{
+    // Display words are already one bit per pixel with the leftmost pixel
+    //  in the top bit, rows are written out most significant byte first
+    const size_t row_size = CAPTURE_WIDTH / 8;
+
+    for (int y = 0; y < CAPTURE_HEIGHT; ++y) {
+        const int row = chip8->hires ? y : y / 2;
+
+        if (chip8->hires) {
+            for (int word = 0; word < DISPLAY_ROW_WORDS; ++word) {
+                const uint64_t bits = chip8->display[0][row][word] | chip8->display[1][row][word];
+
+                for (int byte = 7; byte >= 0; --byte) {
+                    *out++ = bits >> (byte * 8);
+                }
+            }
+        } else if (y & 1) {
+            // Lo-res rows are shown twice
+            memcpy(out, out - row_size, row_size);
+            out += row_size;
+        } else {
+            const uint64_t bits = chip8->display[0][row][0] | chip8->display[1][row][0];
+
+            for (int byte = 7; byte >= 0; --byte) {
+                const uint16_t doubled = capture_double_bits(bits >> (byte * 8));
+                *out++ = doubled >> 8;
+                *out++ = doubled;
+            }
+        }
+    }
+}
+
+void capture_frame(Capture* capture, const Chip8* chip8, const uint32_t palette[4])
+{
+    if (!capture->video.file) {
+        return;
+    }
+
+    if (capture->format == CAPTURE_RGBA) {
+        capture_rgba(capture_reserve(&capture->video, CAPTURE_WIDTH * CAPTURE_HEIGHT * 4),
+            chip8, palette);
+    } else {
+        capture_mono(capture_reserve(&capture->video, CAPTURE_WIDTH * CAPTURE_HEIGHT / 8), chip8);
+    }
+
+    capture->frames++;
+}
+
+void capture_audio(Capture* capture, uint64_t instructions, uint16_t ips, bool tone)
+{
+    // The samples covering instructions at the machine's clock rate, the
+    //  fraction of a sample carries over so the stream never drifts
+    if (!capture->audio.file) {
+        return;
+    }
+
+    const uint64_t total = instructions * AUDIO_FREQUENCY + capture->sample_remainder;
+    uint64_t count = total / ips;
+    capture->sample_remainder = total % ips;
+
+    const uint32_t period = AUDIO_FREQUENCY / AUDIO_WAVE_FREQUENCY;
+    capture->samples += count;
+
+    while (count > 0) {
+        const uint64_t chunk = count < CAPTURE_BUFFER_SIZE / 2 ? count : CAPTURE_BUFFER_SIZE / 2;
+        uint8_t* out = capture_reserve(&capture->audio, chunk * 2);
+
+        for (uint64_t i = 0; i < chunk; ++i) {
+            int16_t sample = 0;
+
+            if (tone) {
+                sample = capture->wave_phase < period / 2 ? -AUDIO_VOLUME : AUDIO_VOLUME;
+            }
+
+            *out++ = (uint16_t)sample & 0xFF;
+            *out++ = (uint16_t)sample >> 8;
+            capture->wave_phase = (capture->wave_phase + 1) % period;
+        }
+
+        count -= chunk;
+    }
+}
+
+bool capture_close(Capture* capture)
+{
+    capture_close_stream(&capture->video);
+    capture_close_stream(&capture->audio);
+
+    if (capture->video.file) {
+        printf("INFO: Captured %llu frames of %ux%u %s at %u fps to \"%s\"\n",
+            (unsigned long long)capture->frames, CAPTURE_WIDTH, CAPTURE_HEIGHT,
+            capture->format == CAPTURE_RGBA ? "rgba" : "monob", CHIP_TIMER_FREQUENCY,
+            capture->video.path);
+    }
+
+    if (capture->audio.file) {
+        printf("INFO: Captured %.3f s of %u Hz s16le mono audio to \"%s\"\n",
+            (double)capture->samples / AUDIO_FREQUENCY, AUDIO_FREQUENCY, capture->audio.path);
+    }
+
+    return !capture->video.failed && !capture->audio.failed;
+}
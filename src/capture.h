@@ -0,0 +1,55 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip.h"
+
+// Raw video and audio of every emulated frame, for piping into an
+//  encoder. Frames are always 128x64, lo-res pixels are doubled, one per
+//  60 Hz timer tick. Audio is the sound timer's square wave as signed 16
+//  bit little endian mono PCM in emulated time
+
+#define CAPTURE_WIDTH HIRES_WIDTH
+#define CAPTURE_HEIGHT HIRES_HEIGHT
+#define CAPTURE_BUFFER_SIZE (1024 * 1024) // Bytes collected before one write
+
+typedef enum CaptureFormat
+{
+    CAPTURE_RGBA = 0, // 4 bytes per pixel from the palette, ffmpeg pix_fmt rgba
+    CAPTURE_MONO      // 1 bit per pixel, set where any plane is, MSB first, pix_fmt monob
+} CaptureFormat;
+
+typedef struct CaptureStream
+{
+    FILE* file;       // Unbuffered, only whole buffers are written
+    const char* path; // "-" for stdout
+    uint8_t* buffer;
+    size_t used;
+    bool failed;      // A write failed, nothing more is written
+} CaptureStream;
+
+typedef struct Capture
+{
+    CaptureFormat format;
+    CaptureStream video; // No file when not capturing video
+    CaptureStream audio; // No file when not capturing audio
+    uint64_t frames;
+    uint64_t samples;
+
+    uint64_t sample_remainder; // Instructions times frequency not yet a whole sample
+    uint32_t wave_phase;       // Samples into the current wave period
+} Capture;
+
+bool capture_format_from_name(const char* name, CaptureFormat* format);
+bool capture_take_stdout(void);
+bool capture_open(Capture* capture, const char* video_path, CaptureFormat format,
+    const char* audio_path);
+void capture_frame(Capture* capture, const Chip8* chip8, const uint32_t palette[4]);
+void capture_audio(Capture* capture, uint64_t instructions, uint16_t ips, bool tone);
+bool capture_close(Capture* capture);
+
+#endif // _CAPTURE_H_
@@ -6,669 +6,1434 @@
 #include <string.h>
 
 #include "font.h"
+#include "profile.h"
+#include "trace.h"
 
-bool chip8_init(Chip8* chip8, const char* rom_path)
+typedef struct QuirkProfile
+{
+    const char* name;
+    uint8_t quirks;
+} QuirkProfile;
+
+static const QuirkProfile g_quirk_profiles[] = {
+    { "chip8", QUIRKS_CHIP8 },
+    { "schip", QUIRKS_SCHIP },
+    { "amiga", QUIRKS_AMIGA },
+    { "xochip", QUIRKS_XOCHIP },
+};
+
+bool chip8_quirks_from_name(const char* name, uint8_t* quirks)
+{
+    for (size_t i = 0; i < sizeof(g_quirk_profiles) / sizeof(g_quirk_profiles[0]); ++i) {
+        if (strcmp(g_quirk_profiles[i].name, name) == 0) {
+            *quirks = g_quirk_profiles[i].quirks;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void chip8_seed(Chip8* chip8, uint64_t seed)
+{
+    // splitmix64 spreads nearby seeds into unrelated xorshift states
+    uint64_t z = seed + 0x9E3779B97F4A7C15;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    z ^= z >> 31;
+
+    chip8->rng_state = z ? z : 1;
+}
+
+bool chip8_set_speed(Chip8* chip8, uint16_t ips)
+{
+    // Call right after loading, like chip8_seed, the timer phase restarts
+    if (ips < CHIP_MIN_INST_PER_SECOND || ips > CHIP_MAX_INST_PER_SECOND) {
+        fprintf(stderr, "ERROR: Speed must be %d to %d instructions per second\n",
+            CHIP_MIN_INST_PER_SECOND, CHIP_MAX_INST_PER_SECOND);
+        return false;
+    }
+
+    chip8->ips = ips;
+    chip8->timer_phase = 0;
+
+    return true;
+}
+
+static uint8_t chip8_random(Chip8* chip8)
+{
+    // xorshift64*, the top byte has the best quality
+    uint64_t x = chip8->rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip8->rng_state = x;
+
+    return (x * 0x2545F4914F6CDD1D) >> 56;
+}
+
+static void chip8_use_ram(Chip8* chip8, uint32_t end)
+{
+    // Grow ram_size to the whole pages below end
+    if (end > chip8->ram_size) {
+        chip8->ram_size = (end + RAM_PAGE_SIZE - 1) / RAM_PAGE_SIZE * RAM_PAGE_SIZE;
+    }
+}
+
+static void chip8_reset(Chip8* chip8, uint8_t quirks)
 {
     // Initialize entire CHIP-8 machine
+    chip8_cleanup(chip8);
     memset(chip8, 0, sizeof(Chip8));
+    chip8->quirks = quirks;
+    chip8->ram_size = RAM_PAGE_SIZE;
 
-    // Set the seed for RNG
-    srand(time(NULL));
+    // Set the seed for RNG, call chip8_seed afterwards for reproducible runs
+    chip8_seed(chip8, time(NULL));
 
     // Set CHIP-8 machine defaults
     chip8->PC = CHIP_ENTRY_POINT;
     chip8->stack_ptr = &chip8->stack[0];
+    chip8->planes = 1;
+    chip8->ips = CHIP_INST_PER_SECOND;
 
-    // Load font
+    // Load fonts
     memcpy(&chip8->ram[0], g_font, sizeof(g_font));
+    memcpy(&chip8->ram[BIG_FONT_ADDRESS], g_big_font, sizeof(g_big_font));
+}
 
-    // Load ROM
-    FILE* rom_file = fopen(rom_path, "rb");
+bool chip8_init_rom(Chip8* chip8, const uint8_t* rom, size_t rom_size, uint8_t quirks)
+{
+    chip8_reset(chip8, quirks);
+
+    if (rom_size > MAX_ROM_SIZE) {
+        fprintf(stderr, "ERROR: ROM size too big\n");
+        return false;
+    }
+
+    memcpy(&chip8->ram[CHIP_ENTRY_POINT], rom, rom_size);
+    chip8_use_ram(chip8, CHIP_ENTRY_POINT + rom_size);
+
+    return true;
+}
+
+void chip8_cleanup(const Chip8* chip8)
+{
+    free(chip8->decoded_high);
+}
+
+bool chip8_read_rom(const char* rom_path, uint8_t* buffer, size_t* size)
+{
+    // Reads up to MAX_ROM_SIZE bytes until end of file, so pipes work as
+    //  well as files, "-" is stdin
+    const bool from_stdin = strcmp(rom_path, "-") == 0;
+    FILE* rom_file = from_stdin ? stdin : fopen(rom_path, "rb");
 
     if (!rom_file) {
         fprintf(stderr, "ERROR: Could not open ROM file \"%s\"\n", rom_path);
         return false;
     }
 
-    fseek(rom_file, 0, SEEK_END);
-    const long rom_size = ftell(rom_file);
-    rewind(rom_file);
+    *size = fread(buffer, 1, MAX_ROM_SIZE, rom_file);
+    const bool failed = ferror(rom_file);
+    const bool too_big = !failed && fgetc(rom_file) != EOF;
 
-    if (rom_size > MAX_ROM_SIZE) {
+    if (!from_stdin) {
+        fclose(rom_file);
+    }
+
+    if (failed) {
+        fprintf(stderr, "ERROR: Could not load ROM file into memory\n");
+        return false;
+    }
+
+    if (too_big) {
         fprintf(stderr, "ERROR: ROM size too big\n");
         return false;
     }
 
-    if (fread(&chip8->ram[CHIP_ENTRY_POINT], rom_size, 1, rom_file) != 1) {
-        fprintf(stderr, "ERROR: Could not load ROM file into memory\n");
+    return true;
+}
+
+bool chip8_init(Chip8* chip8, const char* rom_path, uint8_t quirks)
+{
+    chip8_reset(chip8, quirks);
+
+    // Load ROM
+    size_t rom_size;
+    if (!chip8_read_rom(rom_path, &chip8->ram[CHIP_ENTRY_POINT], &rom_size)) {
         return false;
     }
 
-    fclose(rom_file);
+    chip8_use_ram(chip8, CHIP_ENTRY_POINT + rom_size);
 
     return true;
 }
 
-#ifdef DEBUG
-void print_debug_info(Chip8* chip8)
+static void chip8_drop_decoded(Chip8* chip8, uint16_t address)
 {
-    printf("Address: 0x%04X, Opcode: 0x%04X Desc: ", chip8->PC - 2, chip8->inst.opcode);
+    // Both bytes of an instruction live in the entry of its even address
+    if (address < RAM_PAGE_SIZE) {
+        chip8->decoded[address / 2].handler = NULL;
+    } else if (chip8->decoded_high) {
+        chip8->decoded_high[(address - RAM_PAGE_SIZE) / 2].handler = NULL;
+    }
+}
 
-    // Emulate opcode
-    switch (chip8->inst.opcode >> 12) {
-    case 0x00:
-        switch (chip8->inst.NN) {
-        case 0xE0:
-            // 0x00E0: Clear the screen
-            printf("Clear the screen\n");
-            break;
+static DecodedInstruction* chip8_decoded_high(Chip8* chip8, uint16_t pc)
+{
+    // Allocated the first time code runs past the first page, NULL when
+    //  that fails and the instruction is decoded every time instead
+    if (!chip8->decoded_high) {
+        chip8->decoded_high = calloc((RAM_CAPACITY - RAM_PAGE_SIZE) / 2, sizeof(DecodedInstruction));
 
-        case 0xEE:
-            // 0x00EE: Return from a subroutine
-            // Pop last address from the stack
-            //  and set PC to it
-            printf("Return from subroutine\n");
-            break;
+        if (!chip8->decoded_high) {
+            return NULL;
+        }
+    }
 
-        default:
-            // Not implemented
-            //   or 0x0NNN: Calls machine code routine at address NNN
-            break;
-            printf("Not implemented\n");
-            break;
+    return &chip8->decoded_high[(pc - RAM_PAGE_SIZE) / 2];
+}
+
+// Write a byte to RAM and drop the predecoded instruction covering it
+static void chip8_write(Chip8* chip8, uint16_t address, uint8_t value)
+{
+    address %= RAM_CAPACITY;
+    chip8->ram[address] = value;
+
+    chip8_use_ram(chip8, address + 1);
+    chip8_drop_decoded(chip8, address);
+}
+
+static uint16_t chip8_opcode_at(const Chip8* chip8, uint16_t address)
+{
+    return (chip8->ram[address % RAM_CAPACITY] << 8) | chip8->ram[(address + 1) % RAM_CAPACITY];
+}
+
+static void chip8_skip(Chip8* chip8)
+{
+    // Skip the next instruction, F000 NNNN is two words long
+    chip8->PC += chip8_opcode_at(chip8, chip8->PC) == 0xF000 ? 4 : 2;
+}
+
+uint8_t chip8_display_width(const Chip8* chip8)
+{
+    return chip8->hires ? HIRES_WIDTH : WINDOW_WIDTH;
+}
+
+uint8_t chip8_display_height(const Chip8* chip8)
+{
+    return chip8->hires ? HIRES_HEIGHT : WINDOW_HEIGHT;
+}
+
+static bool chip8_plane_selected(const Chip8* chip8, uint8_t plane)
+{
+    return chip8->planes & (1 << plane);
+}
+
+static void op_00E0(Chip8* chip8)
+{
+    // 0x00E0: Clear the screen, only the selected planes
+    const size_t size = chip8_display_height(chip8) * sizeof(chip8->display[0][0]);
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (chip8_plane_selected(chip8, plane)) {
+            memset(chip8->display[plane], 0, size);
         }
-        break;
+    }
+}
 
-    case 0x01:
-        // 0x1NNN: Jump to address NNN
-        printf("Jump to address NNN (0x%04X)\n", chip8->inst.NNN);
-        break;
+// Scrolls move whole rows with memmove and shift packed words sideways,
+//   in pixels of the current resolution
+static void op_00CN(Chip8* chip8)
+{
+    // 0x00CN: Scroll the selected planes down by N rows
+    const uint8_t height = chip8_display_height(chip8);
+    const uint8_t n = chip8->inst.N;
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (chip8_plane_selected(chip8, plane)) {
+            uint64_t (*rows)[DISPLAY_ROW_WORDS] = chip8->display[plane];
+            memmove(&rows[n], &rows[0], (height - n) * sizeof(rows[0]));
+            memset(&rows[0], 0, n * sizeof(rows[0]));
+        }
+    }
+}
 
-    case 0x02:
-        // 0x2NNN: Call subroutine at NNN
-        // Push PC in the stack and set PC
-        //   to the jump address
-        printf("Call subroutine at NNN (0x%04X)\n", chip8->inst.NNN);
-        break;
+static void op_00DN(Chip8* chip8)
+{
+    // 0x00DN: Scroll the selected planes up by N rows (XO-CHIP)
+    const uint8_t height = chip8_display_height(chip8);
+    const uint8_t n = chip8->inst.N;
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (chip8_plane_selected(chip8, plane)) {
+            uint64_t (*rows)[DISPLAY_ROW_WORDS] = chip8->display[plane];
+            memmove(&rows[0], &rows[n], (height - n) * sizeof(rows[0]));
+            memset(&rows[height - n], 0, n * sizeof(rows[0]));
+        }
+    }
+}
 
-    case 0x03:
-        // 0x3XNN: Skip the next instruction if VX equals NN
-        printf("Skip the next instruction if V%X (0x%02X) equals NN (0x%02X)\n",
-            chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
-        break;
+static void op_00FB(Chip8* chip8)
+{
+    // 0x00FB: Scroll the selected planes right by 4 pixels
+    const uint8_t height = chip8_display_height(chip8);
 
-    case 0x04:
-        // 0x4XNN: Skip the next instruction if VX does not equal NN
-        printf("Skip the next instruction if V%X (0x%02X) does not equal NN (0x%02X)\n",
-            chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
-        break;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!chip8_plane_selected(chip8, plane)) {
+            continue;
+        }
 
-    case 0x05:
-        // 0x5XY0: Skip the next instruction if VX equals VY
-        printf("Skip the next instruction if V%X (0x%02X) equals V%X (0x%02X)\n",
-            chip8->inst.X, chip8->V[chip8->inst.X],
-            chip8->inst.Y, chip8->V[chip8->inst.Y]);
-        break;
-
-    case 0x06:
-        // 0x6XNN: Set VX to NN
-        printf("Set V%X to NN (0x%02X)\n", chip8->inst.X, chip8->inst.NN);
-        break;
-
-    case 0x07:
-        // 0x7XNN: Adds NN to VX (carry flag is not changed)
-        printf("Adds NN (0x%02X) to V%X (0x%02X)\n",
-            chip8->inst.NN, chip8->inst.X, chip8->V[chip8->inst.X]);
-        break;
+        for (uint8_t y = 0; y < height; ++y) {
+            uint64_t* row = chip8->display[plane][y];
 
-    case 0x08:
-        switch (chip8->inst.N) {
-        case 0x0:
-            // 0x8XY0: Set VX to the value of VY
-            chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
-            printf("Set V%X (0x%02X) to the value of V%X (0x%02X)\n",
-                chip8->inst.X, chip8->V[chip8->inst.X],
-                chip8->inst.Y, chip8->V[chip8->inst.Y]);
-            break;
+            if (chip8->hires) {
+                row[1] = (row[1] >> 4) | (row[0] << 60);
+            }
 
-        case 0x1:
-            // 0x8XY1: Set VX to VX or VY (bitwise)
-            printf("Set V%X (0x%02X) to V%X or V%X (0x%02X) (bitwise)\n",
-                chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.X,
-                chip8->inst.Y, chip8->V[chip8->inst.Y]);
-            break;
+            row[0] >>= 4;
+        }
+    }
+}
 
-        case 0x2:
-            // 0x8XY2: Set VX to VX and VY (bitwise)
-            printf("Set V%X (0x%02X) to V%X and V%X (0x%02X) (bitwise)\n",
-                chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.X,
-                chip8->inst.Y, chip8->V[chip8->inst.Y]);
-            break;
+static void op_00FC(Chip8* chip8)
+{
+    // 0x00FC: Scroll the selected planes left by 4 pixels
+    const uint8_t height = chip8_display_height(chip8);
 
-        case 0x3:
-            // 0x8XY3: Set VX to VX xor VY
-            printf("Set V%X (0x%02X) to V%X xor V%X (0x%02X)\n",
-                chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.X,
-                chip8->inst.Y, chip8->V[chip8->inst.Y]);
-            break;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!chip8_plane_selected(chip8, plane)) {
+            continue;
+        }
 
-        case 0x4:
-            // 0x8XY4: Add VY to VX, set VF
-            printf("Add V%X (0x%02X) to V%X (0x%02X), set VF flag\n",
-                chip8->inst.X, chip8->V[chip8->inst.X],
-                chip8->inst.Y, chip8->V[chip8->inst.Y]);
-            break;
+        for (uint8_t y = 0; y < height; ++y) {
+            uint64_t* row = chip8->display[plane][y];
+            row[0] <<= 4;
 
-        case 0x5:
-            // 0x8XY5: VY is subtracted from VX, set VF
-            printf("V%X (0x%02X) is subtracted from V%X (0x%02X), set VF flag\n",
-                chip8->inst.Y, chip8->V[chip8->inst.Y],
-                chip8->inst.X, chip8->V[chip8->inst.X]);
-            break;
+            if (chip8->hires) {
+                row[0] |= row[1] >> 60;
+                row[1] <<= 4;
+            }
+        }
+    }
+}
 
-        case 0x6:
-            // 0x8XY6: Stores the least significant bit of VX in VF
-            //   and then shifts VX to the right by 1
-            printf("Shift V%X to the right by 1, set VF flag\n", chip8->inst.X);
-            break;
+static void op_00FD(Chip8* chip8)
+{
+    // 0x00FD: Exit the interpreter, the machine stays on this instruction
+    chip8->PC -= 2;
+}
 
-        case 0x7:
-            // 0x8XY7: Set VX to VY minus VX, set VF
-            printf("Set V%X to V%X (%02X) minus V%X (%02X), set VF\n",
-                chip8->inst.X, chip8->inst.Y, chip8->V[chip8->inst.Y],
-                chip8->inst.X, chip8->V[chip8->inst.X]);
-            break;
+// 0x00FE: Switch to 64x32 lo-res
+// 0x00FF: Switch to 128x64 hi-res
+//   Both clear every plane
+static void op_00FE(Chip8* chip8)
+{
+    chip8->hires = false;
+    memset(chip8->display, 0, sizeof(chip8->display));
+}
 
-        case 0xE:
-            // 0x8XYE: Stores the most significant bit of VX in VF
-            //  and then shifts VX to the left by 1
-            printf("Shift V%X to the left by 1, set VF flag\n", chip8->inst.X);
-            break;
+static void op_00FF(Chip8* chip8)
+{
+    chip8->hires = true;
+    memset(chip8->display, 0, sizeof(chip8->display));
+}
 
-        default:
-            // Not implemented or bad opcode
-            printf("Not implemented or bad opcode\n");
-            break;
+static void op_00EE(Chip8* chip8)
+{
+    // 0x00EE: Return from a subroutine
+    // Pop last address from the stack
+    //  and set PC to it
+    chip8->PC = *--chip8->stack_ptr;
+}
+
+static void op_nop(Chip8* chip8)
+{
+    // Not implemented or invalid opcode
+    //   or 0x0NNN: Calls machine code routine at address NNN
+    (void)chip8;
+}
+
+static void op_1NNN(Chip8* chip8)
+{
+    // 0x1NNN: Jump to address NNN
+    chip8->PC = chip8->inst.NNN;
+}
+
+static void op_2NNN(Chip8* chip8)
+{
+    // 0x2NNN: Call subroutine at NNN
+    // Push PC in the stack and set PC
+    //   to the jump address
+    *chip8->stack_ptr++ = chip8->PC;
+    chip8->PC = chip8->inst.NNN;
+}
+
+static void op_3XNN(Chip8* chip8)
+{
+    // 0x3XNN: Skip the next instruction if VX equals NN
+    if (chip8->V[chip8->inst.X] == chip8->inst.NN) {
+        chip8_skip(chip8);
+    }
+}
+
+static void op_4XNN(Chip8* chip8)
+{
+    // 0x4XNN: Skip the next instruction if VX does not equal NN
+    if (chip8->V[chip8->inst.X] != chip8->inst.NN) {
+        chip8_skip(chip8);
+    }
+}
+
+static void op_5XY0(Chip8* chip8)
+{
+    // 0x5XY0: Skip the next instruction if VX equals VY
+    if (chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y]) {
+        chip8_skip(chip8);
+    }
+}
+
+// 0x5XY2: Store VX to VY in memory starting at I, VY first if it is
+//   the lower register. I is not changed (XO-CHIP)
+// 0x5XY3: Load VX to VY from memory starting at I, in the same order
+#define DEFINE_RANGE_OP(name, store)                                        \
+    static void name(Chip8* chip8)                                          \
+    {                                                                       \
+        const uint8_t x = chip8->inst.X;                                    \
+        const uint8_t y = chip8->inst.Y;                                    \
+        const uint8_t count = (x <= y ? y - x : x - y) + 1;                 \
+        for (uint8_t i = 0; i < count; ++i) {                               \
+            const uint8_t reg = x <= y ? x + i : x - i;                     \
+            const uint16_t address = chip8->I + i;                          \
+            if (store) {                                                    \
+                chip8_write(chip8, address, chip8->V[reg]);                 \
+            } else {                                                        \
+                chip8->V[reg] = chip8->ram[address % RAM_CAPACITY];         \
+            }                                                               \
+        }                                                                   \
+    }
+
+DEFINE_RANGE_OP(op_5XY2, true)
+DEFINE_RANGE_OP(op_5XY3, false)
+
+static void op_6XNN(Chip8* chip8)
+{
+    // 0x6XNN: Set VX to NN
+    chip8->V[chip8->inst.X] = chip8->inst.NN;
+}
+
+static void op_7XNN(Chip8* chip8)
+{
+    // 0x7XNN: Adds NN to VX (carry flag is not changed)
+    chip8->V[chip8->inst.X] += chip8->inst.NN;
+}
+
+static void op_8XY0(Chip8* chip8)
+{
+    // 0x8XY0: Set VX to the value of VY
+    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
+}
+
+// Quirk dependent handlers are stamped out once per quirk setting.
+//   The decoder picks the variant, so a quirk costs nothing per instruction
+
+// 0x8XY1: Set VX to VX or VY (bitwise)
+// 0x8XY2: Set VX to VX and VY (bitwise)
+// 0x8XY3: Set VX to VX xor VY
+//   The original CHIP-8 resets VF (QUIRK_VF_RESET)
+#define DEFINE_LOGIC_OP(name, op, vf_reset)                 \
+    static void name(Chip8* chip8)                          \
+    {                                                       \
+        chip8->V[chip8->inst.X] op chip8->V[chip8->inst.Y]; \
+        if (vf_reset) {                                     \
+            chip8->V[0xF] = 0;                              \
+        }                                                   \
+    }
+
+DEFINE_LOGIC_OP(op_8XY1, |=, false)
+DEFINE_LOGIC_OP(op_8XY2, &=, false)
+DEFINE_LOGIC_OP(op_8XY3, ^=, false)
+DEFINE_LOGIC_OP(op_8XY1_vf_reset, |=, true)
+DEFINE_LOGIC_OP(op_8XY2_vf_reset, &=, true)
+DEFINE_LOGIC_OP(op_8XY3_vf_reset, ^=, true)
+
+static void op_8XY4(Chip8* chip8)
+{
+    // 0x8XY4: Add VY to VX, set VF
+    const uint8_t flag = ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
+
+    chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
+    chip8->V[0xF] = flag;
+}
+
+static void op_8XY5(Chip8* chip8)
+{
+    // 0x8XY5: VY is subtracted from VX, set VF
+    const uint8_t flag = (chip8->V[chip8->inst.Y] <= chip8->V[chip8->inst.X]);
+
+    chip8->V[chip8->inst.X] -= chip8->V[chip8->inst.Y];
+    chip8->V[0xF] = flag;
+}
+
+// 0x8XY6: Stores the least significant bit of VX in VF
+//   and then shifts VX to the right by 1
+// 0x8XYE: Stores the most significant bit of VX in VF
+//  and then shifts VX to the left by 1
+//
+// CHIP-8 shifs the value in the register VY and stores the result in VX (QUIRK_SHIFT_VY).
+//   The CHIP-48 and SCHIP implementations instead ignored VY, and simply shifted VX
+#define DEFINE_SHIFT_OP(name, source, op, flag_expr) \
+    static void name(Chip8* chip8)                  \
+    {                                               \
+        const uint8_t value = chip8->V[source];     \
+        const uint8_t flag = (flag_expr);           \
+                                                    \
+        chip8->V[chip8->inst.X] = value op 1;       \
+        chip8->V[0xF] = flag;                       \
+    }
+
+DEFINE_SHIFT_OP(op_8XY6, chip8->inst.X, >>, value & 1)
+DEFINE_SHIFT_OP(op_8XYE, chip8->inst.X, <<, (value & 0x80) >> 7)
+DEFINE_SHIFT_OP(op_8XY6_shift_vy, chip8->inst.Y, >>, value & 1)
+DEFINE_SHIFT_OP(op_8XYE_shift_vy, chip8->inst.Y, <<, (value & 0x80) >> 7)
+
+static void op_8XY7(Chip8* chip8)
+{
+    // 0x8XY7: Set VX to VY minus VX, set VF
+    const uint8_t flag = (chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y]);
+
+    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
+    chip8->V[0xF] = flag;
+}
+
+static void op_9XY0(Chip8* chip8)
+{
+    // 0x9XY0: Skip the next instruction if VX does not equal VY
+    if (chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y]) {
+        chip8_skip(chip8);
+    }
+}
+
+static void op_ANNN(Chip8* chip8)
+{
+    // 0xANNN: Set I to the address NNN
+    chip8->I = chip8->inst.NNN;
+}
+
+static void op_BNNN(Chip8* chip8)
+{
+    // 0xBNNN: Jump to the address NNN plus V0
+    chip8->PC = chip8->inst.NNN + chip8->V[0];
+}
+
+static void op_CXNN(Chip8* chip8)
+{
+    // 0xCXNN: Set VX to the result of a bitwise and operation
+    //  on a random number and NN
+    chip8->V[chip8->inst.X] = chip8_random(chip8) & chip8->inst.NN;
+}
+
+static void op_DXYN(Chip8* chip8)
+{
+    // 0xDXYN: Draw a sprite at coordinate (VX, VY)
+    //  Read from memory location I, N rows of 8 pixels or 16x16 if N is 0.
+    //  Every selected plane draws the next sprite in memory.
+    //  VF (Carry flag) is set if any screen pixels are set off
+    const uint8_t height = chip8_display_height(chip8);
+    const uint8_t x_coord = chip8->V[chip8->inst.X] % chip8_display_width(chip8);
+    const uint8_t y_coord = chip8->V[chip8->inst.Y] % height;
+    const bool wide = chip8->inst.N == 0;
+    const uint8_t sprite_rows = wide ? 16 : chip8->inst.N;
+    const uint8_t row_bytes = wide ? 2 : 1;
+
+    // Sprites are clipped at the bottom edge of the screen
+    uint8_t rows = sprite_rows;
+    if (rows > height - y_coord) {
+        rows = height - y_coord;
+    }
+
+    // A row lands in the word holding X and may spill into the next one,
+    //  which is only on screen in hi-res. Bits past the right edge are
+    //  shifted out
+    const uint8_t word = x_coord / 64;
+    const uint8_t shift = x_coord % 64;
+    const bool spill = chip8->hires && word == 0 && shift > 64 - 8 * row_bytes;
+
+    uint16_t address = chip8->I;
+    uint64_t collision = 0;
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!chip8_plane_selected(chip8, plane)) {
+            continue;
         }
-        break;
-
-    case 0x09:
-        // 0x9XY0: Skip the next instruction if VX does not equal VY
-        printf("Skip the next instruction if V%X (%02X) does not equal V%X (%02X)\n",
-            chip8->inst.X, chip8->V[chip8->inst.X],
-            chip8->inst.Y, chip8->V[chip8->inst.Y]);
-        break;
-
-    case 0x0A:
-        // 0xANNN: Set I to the address NNN
-        printf("Set I to NNN (0x%04X)\n", chip8->inst.NNN);
-        break;
-
-    case 0x0B:
-        // 0xBNNN: Jump to the address NNN plus V0
-        printf("Jump to the address NNN (0x%04X) plus V0 (0x%02X)\n", chip8->inst.NNN, chip8->V[0]);
-        break;
-
-    case 0x0C:
-        // 0xCXNN: Set VX to the result of a bitwise and operation
-        //  on a random number and NN
-        printf("Set V%X to the result of a bitwise and"
-            "operation on a random number and NN (0x02%X)\n", chip8->inst.X, chip8->inst.NN);
-        break;
-
-    case 0x0D:
-        // 0xDXYN: Draw a sprite at coordinate (VX, VY)
-        //  Read from memory location I.
-        //  VF (Carry flag) is set if any screen pixels are set off
-        printf("Draw N (%u) height sprite at coords "
-            "V%X (0x%02X), V%X (0x%02X) from memory location I (0x%04X)\n",
-            chip8->inst.N,
-            chip8->inst.X, chip8->V[chip8->inst.X],
-            chip8->inst.Y, chip8->V[chip8->inst.Y], chip8->I);
-        break;
 
-    case 0x0E:
-        switch (chip8->inst.NN) {
-        case 0x9E:
-            // 0xEX9E: Skip the next instruction if the key stored in VX is pressed
-            printf("Skip the next instruction if the key stored in V%X (0x%02X) is pressed\n",
-                chip8->inst.X, chip8->V[chip8->inst.X]);
-            break;
+        for (uint8_t i = 0; i < rows; ++i) {
+            const uint16_t at = address + i * row_bytes;
+            uint64_t sprite_row = (uint64_t)chip8->ram[at] << 56;
 
-        case 0xA1:
-            // 0xEXA1: Skips the next instruction if the key stored in VX is not pressed
-            printf("Skip the next instruction if the key stored in V%X (0x%02X) is not pressed\n",
-                chip8->inst.X, chip8->V[chip8->inst.X]);
-            break;
+            if (wide) {
+                sprite_row |= (uint64_t)chip8->ram[(at + 1) % RAM_CAPACITY] << 48;
+            }
+
+            uint64_t* row = chip8->display[plane][y_coord + i];
+            const uint64_t left = sprite_row >> shift;
 
-        default:
-            printf("Not implemented or invalid opcode\n");
-            break; // Not implemented or invalid opcode
+            // Pixels set in both the sprite and the display are turned off
+            collision |= row[word] & left;
+            row[word] ^= left;
+
+            if (spill) {
+                const uint64_t right = sprite_row << (64 - shift);
+                collision |= row[1] & right;
+                row[1] ^= right;
+            }
         }
-        break;
 
-    case 0x0F:
-        switch (chip8->inst.NN) {
-        case 0x07:
-            // 0xFX07: Set VX to the value of the delay timer
-            printf("Set V%X to the value of the delay timer (0x%02X)\n",
-                chip8->inst.X, chip8->delay_timer);
-            break;
+        address += sprite_rows * row_bytes;
+    }
 
-        case 0x0A:
-            // 0xFX0A: A key press is awaited, and then stored in VX (blocking operation)
-            printf("A key press is awaited, and then stored in V%X (blocking operation)\n",
-                chip8->inst.X);
-            break;
+    chip8->V[0xF] = collision != 0;
+}
 
-        case 0x15:
-            // 0xFX15: Set the delay timer to VX
-            printf("Set the delay timer (0x%02X) to V%X\n",
-                chip8->delay_timer, chip8->inst.X);
-            break;
+static void op_EX9E(Chip8* chip8)
+{
+    // 0xEX9E: Skip the next instruction if the key stored in VX is pressed
+    if (chip8->keypad[chip8->V[chip8->inst.X]]) {
+        chip8_skip(chip8);
+    }
+}
 
-        case 0x18:
-            // 0xFX18: Set the sound timer to VX
-            printf("Set the sound timer (0x%02X) to V%X\n",
-                chip8->sound_timer, chip8->inst.X);
-            break;
+static void op_EXA1(Chip8* chip8)
+{
+    // 0xEXA1: Skips the next instruction if the key stored in VX is not pressed
+    if (!chip8->keypad[chip8->V[chip8->inst.X]]) {
+        chip8_skip(chip8);
+    }
+}
 
-        case 0x29:
-            // 0xFX29: Set I to the location of the sprite for the character in VX.
-            //   Characters 0-F (in hexadecimal) are represented by a 4x5 font
-            printf("Set I to the location of the sprite for the character in V%X (0x%02X)\n",
-                chip8->inst.X, chip8->V[chip8->inst.X]);
-            break;
+static void op_FX07(Chip8* chip8)
+{
+    // 0xFX07: Set VX to the value of the delay timer
+    chip8->V[chip8->inst.X] = chip8->delay_timer;
+}
 
-        case 0x33:
-            // 0xFX33: Stores the BCD representation of VX,
-            //   with the hundreds digit in memory at location in I, the tens
-            //   digit at location I+1, and the ones digit at location I+2
-            printf("Stores the BCD representation of V%X in memory at location I (0x%02X)\n",
-                chip8->inst.X, chip8->I);
+static void op_FX0A(Chip8* chip8)
+{
+    // 0xFX0A: A key press is awaited, and then stored in VX (blocking operation)
+    for (uint8_t i = 0; !chip8->waiting_release && i < sizeof(chip8->keypad); ++i) {
+        if (chip8->keypad[i]) {
+            chip8->awaited_key = i;
+            chip8->waiting_release = true;
             break;
+        }
+    }
 
-        case 0x55:
-            // 0xFX55: Stores from V0 to VX (including VX) in memory, starting at address I.
-            printf("Dump registers from V0 to V%X at memory location I (0x%02X)\n",
-                chip8->inst.X, chip8->I);
-            break;
+    if (!chip8->waiting_release) {
+        // Keep running this instruction until a key is pressed
+        chip8->PC -= 2;
+    } else {
+        // A key is pressed, wait until the key is released
+        if (chip8->keypad[chip8->awaited_key]) {
+            chip8->PC -= 2;
+        } else {
+            chip8->V[chip8->inst.X] = chip8->awaited_key;
+            chip8->waiting_release = false;
+        }
+    }
+}
 
-        case 0x65:
-            // 0xFX65: Stores from V0 to VX (including VX) in memory, starting at address I.
-            printf("Load registers from V0 to V%X from memory location I (0x%02X)\n",
-                chip8->inst.X, chip8->I);
-            break;
+static void op_FX15(Chip8* chip8)
+{
+    // 0xFX15: Set the delay timer to VX
+    chip8->delay_timer = chip8->V[chip8->inst.X];
+}
 
-        case 0x1E:
-            // 0xFX1E: Add VX to I. VF is not affected
-            printf("Add V%X to I (0x%04X)\n", chip8->inst.X, chip8->I);
-            break;
+static void op_FX18(Chip8* chip8)
+{
+    // 0xFX18: Set the sound timer to VX. Turning the tone on or off ends
+    //  the step so audio can switch at this instruction
+    const bool tone = chip8->sound_timer > 0;
+    chip8->sound_timer = chip8->V[chip8->inst.X];
+    chip8->sound_edge = tone != (chip8->sound_timer > 0);
+}
+
+// 0xFX1E: Add VX to I. VF is not affected.
+// CHIP-8 interpreter for the Commodore Amiga sets VF to 1
+//   when there is a range overflow (I+VX>0xFFF) (QUIRK_FX1E_OVERFLOW)
+#define DEFINE_ADD_I_OP(name, set_vf)                   \
+    static void name(Chip8* chip8)                      \
+    {                                                   \
+        chip8->I += chip8->V[chip8->inst.X];            \
+        if (set_vf) {                                   \
+            chip8->V[0xF] = chip8->I > 0xFFF;           \
+        }                                               \
+    }
+
+DEFINE_ADD_I_OP(op_FX1E, false)
+DEFINE_ADD_I_OP(op_FX1E_overflow, true)
+
+static void op_FX29(Chip8* chip8)
+{
+    // 0xFX29: Set I to the location of the sprite for the character in VX.
+    //   Characters 0-F (in hexadecimal) are represented by a 4x5 font
+    chip8->I = chip8->V[chip8->inst.X] * 5;
+}
+
+static void op_FX30(Chip8* chip8)
+{
+    // 0xFX30: Set I to the location of the 8x10 sprite for the digit in VX
+    chip8->I = BIG_FONT_ADDRESS + (chip8->V[chip8->inst.X] & 0x0F) * 10;
+}
+
+static void op_FX33(Chip8* chip8)
+{
+    // 0xFX33: Stores the BCD representation of VX,
+    //   with the hundreds digit in memory at location in I, the tens
+    //   digit at location I+1, and the ones digit at location I+2
+    uint8_t bcd = chip8->V[chip8->inst.X];
+
+    chip8_write(chip8, chip8->I + 2, bcd % 10);
+    bcd /= 10;
+    chip8_write(chip8, chip8->I + 1, bcd % 10);
+    bcd /= 10;
+    chip8_write(chip8, chip8->I, bcd);
+}
+
+// 0xFX55: Stores from V0 to VX (including VX) in memory, starting at address I.
+// 0xFX65: Loads from V0 to VX (including VX) from memory, starting at address I.
+//   CHIP-8 increments I (QUIRK_MEMORY_INCREMENT_I), SCHIP does not
+#define DEFINE_STORE_OP(name, increment_i)                          \
+    static void name(Chip8* chip8)                                  \
+    {                                                               \
+        for (uint8_t i = 0; i <= chip8->inst.X; ++i) {              \
+            chip8_write(chip8, chip8->I + i, chip8->V[i]);          \
+        }                                                           \
+        if (increment_i) {                                          \
+            chip8->I += chip8->inst.X + 1;                          \
+        }                                                           \
+    }
+
+#define DEFINE_LOAD_OP(name, increment_i)                           \
+    static void name(Chip8* chip8)                                  \
+    {                                                               \
+        for (uint8_t i = 0; i <= chip8->inst.X; ++i) {              \
+            chip8->V[i] = chip8->ram[(chip8->I + i) % RAM_CAPACITY]; \
+        }                                                           \
+        if (increment_i) {                                          \
+            chip8->I += chip8->inst.X + 1;                          \
+        }                                                           \
+    }
+
+static void op_FX75(Chip8* chip8)
+{
+    // 0xFX75: Store V0 to VX in the RPL user flags
+    memcpy(chip8->flags, chip8->V, chip8->inst.X + 1);
+}
+
+static void op_FX85(Chip8* chip8)
+{
+    // 0xFX85: Load V0 to VX from the RPL user flags
+    memcpy(chip8->V, chip8->flags, chip8->inst.X + 1);
+}
+
+static void op_FN01(Chip8* chip8)
+{
+    // 0xFN01: Select the planes drawn, cleared and scrolled (XO-CHIP)
+    chip8->planes = chip8->inst.X & 0x03;
+}
+
+static void op_F000(Chip8* chip8)
+{
+    // 0xF000 NNNN: Set I to the 16 bit address in the next word (XO-CHIP)
+    chip8->I = chip8_opcode_at(chip8, chip8->PC);
+    chip8->PC += 2;
+}
+
+DEFINE_STORE_OP(op_FX55, false)
+DEFINE_LOAD_OP(op_FX65, false)
+DEFINE_STORE_OP(op_FX55_increment_i, true)
+DEFINE_LOAD_OP(op_FX65_increment_i, true)
+
+// Pick the handler variant stamped out for the active quirk
+#define QUIRK_HANDLER(quirks, quirk, with, without) \
+    (((quirks) & (quirk)) ? (with) : (without))
 
-        default:
-            printf("Not implemented or invalid opcode\n");
-            break; // Not implemented or invalid opcode
+// Fill out the instruction format of an opcode and select its handler
+static InstructionHandler chip8_decode(uint16_t opcode, uint8_t quirks, Instruction* inst)
+{
+    inst->opcode = opcode;
+    inst->NNN = opcode & 0x0FFF;
+    inst->NN = opcode & 0x0FF;
+    inst->N = opcode & 0x0F;
+    inst->X = (opcode >> 8) & 0x0F;
+    inst->Y = (opcode >> 4) & 0x0F;
+
+    switch (opcode >> 12) {
+    case 0x00:
+        switch (inst->NN) {
+        case 0xE0: return op_00E0;
+        case 0xEE: return op_00EE;
+        case 0xFB: return op_00FB;
+        case 0xFC: return op_00FC;
+        case 0xFD: return op_00FD;
+        case 0xFE: return op_00FE;
+        case 0xFF: return op_00FF;
+        default:   break;
+        }
+
+        switch (opcode & 0xFFF0) {
+        case 0x00C0: return op_00CN;
+        case 0x00D0: return op_00DN;
+        default:     return op_nop;
+        }
+
+    case 0x01: return op_1NNN;
+    case 0x02: return op_2NNN;
+    case 0x03: return op_3XNN;
+    case 0x04: return op_4XNN;
+    case 0x05:
+        switch (inst->N) {
+        case 0x2: return op_5XY2;
+        case 0x3: return op_5XY3;
+        default:  return op_5XY0;
+        }
+
+    case 0x06: return op_6XNN;
+    case 0x07: return op_7XNN;
+
+    case 0x08:
+        switch (inst->N) {
+        case 0x0: return op_8XY0;
+        case 0x1: return QUIRK_HANDLER(quirks, QUIRK_VF_RESET, op_8XY1_vf_reset, op_8XY1);
+        case 0x2: return QUIRK_HANDLER(quirks, QUIRK_VF_RESET, op_8XY2_vf_reset, op_8XY2);
+        case 0x3: return QUIRK_HANDLER(quirks, QUIRK_VF_RESET, op_8XY3_vf_reset, op_8XY3);
+        case 0x4: return op_8XY4;
+        case 0x5: return op_8XY5;
+        case 0x6: return QUIRK_HANDLER(quirks, QUIRK_SHIFT_VY, op_8XY6_shift_vy, op_8XY6);
+        case 0x7: return op_8XY7;
+        case 0xE: return QUIRK_HANDLER(quirks, QUIRK_SHIFT_VY, op_8XYE_shift_vy, op_8XYE);
+        default:  return op_nop;
+        }
+
+    case 0x09: return op_9XY0;
+    case 0x0A: return op_ANNN;
+    case 0x0B: return op_BNNN;
+    case 0x0C: return op_CXNN;
+    case 0x0D: return op_DXYN;
+
+    case 0x0E:
+        switch (inst->NN) {
+        case 0x9E: return op_EX9E;
+        case 0xA1: return op_EXA1;
+        default:   return op_nop;
+        }
+
+    case 0x0F:
+        switch (inst->NN) {
+        case 0x00: return opcode == 0xF000 ? op_F000 : op_nop;
+        case 0x01: return op_FN01;
+        case 0x07: return op_FX07;
+        case 0x0A: return op_FX0A;
+        case 0x15: return op_FX15;
+        case 0x18: return op_FX18;
+        case 0x1E: return QUIRK_HANDLER(quirks, QUIRK_FX1E_OVERFLOW, op_FX1E_overflow, op_FX1E);
+        case 0x29: return op_FX29;
+        case 0x30: return op_FX30;
+        case 0x33: return op_FX33;
+        case 0x55: return QUIRK_HANDLER(quirks, QUIRK_MEMORY_INCREMENT_I, op_FX55_increment_i, op_FX55);
+        case 0x65: return QUIRK_HANDLER(quirks, QUIRK_MEMORY_INCREMENT_I, op_FX65_increment_i, op_FX65);
+        case 0x75: return op_FX75;
+        case 0x85: return op_FX85;
+        default:   return op_nop; // Includes the XO-CHIP audio opcodes F002 and FX3A
         }
-        break;
 
     default:
-        printf("Not implemented or bad opcode\n");
-        break; // Not implemented or invalid opcode
+        return op_nop; // Not implemented or invalid opcode
+    }
+}
+
+typedef enum OpcodeOperands
+{
+    OPERANDS_NONE = 0,
+    OPERANDS_N,
+    OPERANDS_NNN,
+    OPERANDS_X,
+    OPERANDS_X_NN,
+    OPERANDS_X_Y,
+    OPERANDS_X_Y_N
+} OpcodeOperands;
+
+typedef struct OpcodeInfo
+{
+    uint16_t mask;
+    uint16_t match;
+    const char* name;     // Opcode class, e.g. "8XY4"
+    const char* mnemonic; // printf format taking the operands in order
+    OpcodeOperands operands;
+} OpcodeInfo;
+
+// Same classes as chip8_decode, the first match wins
+static const OpcodeInfo g_opcodes[] = {
+    { 0xFFFF, 0x00E0, "00E0", "CLS",                OPERANDS_NONE },
+    { 0xFFFF, 0x00EE, "00EE", "RET",                OPERANDS_NONE },
+    { 0xFFF0, 0x00C0, "00CN", "SCD %u",             OPERANDS_N },
+    { 0xFFF0, 0x00D0, "00DN", "SCU %u",             OPERANDS_N },
+    { 0xFFFF, 0x00FB, "00FB", "SCR",                OPERANDS_NONE },
+    { 0xFFFF, 0x00FC, "00FC", "SCL",                OPERANDS_NONE },
+    { 0xFFFF, 0x00FD, "00FD", "EXIT",               OPERANDS_NONE },
+    { 0xFFFF, 0x00FE, "00FE", "LOW",                OPERANDS_NONE },
+    { 0xFFFF, 0x00FF, "00FF", "HIGH",               OPERANDS_NONE },
+    { 0xF000, 0x0000, "0NNN", "SYS 0x%03X",         OPERANDS_NNN },
+    { 0xF000, 0x1000, "1NNN", "JP 0x%03X",          OPERANDS_NNN },
+    { 0xF000, 0x2000, "2NNN", "CALL 0x%03X",        OPERANDS_NNN },
+    { 0xF000, 0x3000, "3XNN", "SE V%X, 0x%02X",     OPERANDS_X_NN },
+    { 0xF000, 0x4000, "4XNN", "SNE V%X, 0x%02X",    OPERANDS_X_NN },
+    { 0xF00F, 0x5002, "5XY2", "LD [I], V%X-V%X",    OPERANDS_X_Y },
+    { 0xF00F, 0x5003, "5XY3", "LD V%X-V%X, [I]",    OPERANDS_X_Y },
+    { 0xF000, 0x5000, "5XY0", "SE V%X, V%X",        OPERANDS_X_Y },
+    { 0xF000, 0x6000, "6XNN", "LD V%X, 0x%02X",     OPERANDS_X_NN },
+    { 0xF000, 0x7000, "7XNN", "ADD V%X, 0x%02X",    OPERANDS_X_NN },
+    { 0xF00F, 0x8000, "8XY0", "LD V%X, V%X",        OPERANDS_X_Y },
+    { 0xF00F, 0x8001, "8XY1", "OR V%X, V%X",        OPERANDS_X_Y },
+    { 0xF00F, 0x8002, "8XY2", "AND V%X, V%X",       OPERANDS_X_Y },
+    { 0xF00F, 0x8003, "8XY3", "XOR V%X, V%X",       OPERANDS_X_Y },
+    { 0xF00F, 0x8004, "8XY4", "ADD V%X, V%X",       OPERANDS_X_Y },
+    { 0xF00F, 0x8005, "8XY5", "SUB V%X, V%X",       OPERANDS_X_Y },
+    { 0xF00F, 0x8006, "8XY6", "SHR V%X, V%X",       OPERANDS_X_Y },
+    { 0xF00F, 0x8007, "8XY7", "SUBN V%X, V%X",      OPERANDS_X_Y },
+    { 0xF00F, 0x800E, "8XYE", "SHL V%X, V%X",       OPERANDS_X_Y },
+    { 0xF000, 0x9000, "9XY0", "SNE V%X, V%X",       OPERANDS_X_Y },
+    { 0xF000, 0xA000, "ANNN", "LD I, 0x%03X",       OPERANDS_NNN },
+    { 0xF000, 0xB000, "BNNN", "JP V0, 0x%03X",      OPERANDS_NNN },
+    { 0xF000, 0xC000, "CXNN", "RND V%X, 0x%02X",    OPERANDS_X_NN },
+    { 0xF000, 0xD000, "DXYN", "DRW V%X, V%X, %u",   OPERANDS_X_Y_N },
+    { 0xF0FF, 0xE09E, "EX9E", "SKP V%X",            OPERANDS_X },
+    { 0xF0FF, 0xE0A1, "EXA1", "SKNP V%X",           OPERANDS_X },
+    { 0xFFFF, 0xF000, "F000", "LD I, LONG",         OPERANDS_NONE },
+    { 0xF0FF, 0xF001, "FN01", "PLANE %X",           OPERANDS_X },
+    { 0xFFFF, 0xF002, "F002", "AUDIO",              OPERANDS_NONE },
+    { 0xF0FF, 0xF007, "FX07", "LD V%X, DT",         OPERANDS_X },
+    { 0xF0FF, 0xF00A, "FX0A", "LD V%X, K",          OPERANDS_X },
+    { 0xF0FF, 0xF015, "FX15", "LD DT, V%X",         OPERANDS_X },
+    { 0xF0FF, 0xF018, "FX18", "LD ST, V%X",         OPERANDS_X },
+    { 0xF0FF, 0xF01E, "FX1E", "ADD I, V%X",         OPERANDS_X },
+    { 0xF0FF, 0xF029, "FX29", "LD F, V%X",          OPERANDS_X },
+    { 0xF0FF, 0xF030, "FX30", "LD HF, V%X",         OPERANDS_X },
+    { 0xF0FF, 0xF033, "FX33", "LD B, V%X",          OPERANDS_X },
+    { 0xF0FF, 0xF03A, "FX3A", "PITCH V%X",          OPERANDS_X },
+    { 0xF0FF, 0xF055, "FX55", "LD [I], V%X",        OPERANDS_X },
+    { 0xF0FF, 0xF065, "FX65", "LD V%X, [I]",        OPERANDS_X },
+    { 0xF0FF, 0xF075, "FX75", "LD R, V%X",          OPERANDS_X },
+    { 0xF0FF, 0xF085, "FX85", "LD V%X, R",          OPERANDS_X },
+};
+
+static const OpcodeInfo* chip8_opcode_info(uint16_t opcode)
+{
+    for (size_t i = 0; i < sizeof(g_opcodes) / sizeof(g_opcodes[0]); ++i) {
+        if ((opcode & g_opcodes[i].mask) == g_opcodes[i].match) {
+            return &g_opcodes[i];
+        }
+    }
+
+    return NULL;
+}
+
+const char* chip8_opcode_name(uint16_t opcode)
+{
+    const OpcodeInfo* info = chip8_opcode_info(opcode);
+    return info ? info->name : "invalid";
+}
+
+void chip8_disassemble(uint16_t opcode, char* out, size_t size)
+{
+    const OpcodeInfo* info = chip8_opcode_info(opcode);
+    const uint8_t x = (opcode >> 8) & 0x0F;
+    const uint8_t y = (opcode >> 4) & 0x0F;
+
+    if (!info) {
+        snprintf(out, size, "DW 0x%04X", opcode);
+        return;
+    }
+
+    switch (info->operands) {
+    case OPERANDS_NONE:  snprintf(out, size, "%s", info->mnemonic); break;
+    case OPERANDS_N:     snprintf(out, size, info->mnemonic, opcode & 0x0F); break;
+    case OPERANDS_NNN:   snprintf(out, size, info->mnemonic, opcode & 0x0FFF); break;
+    case OPERANDS_X:     snprintf(out, size, info->mnemonic, x); break;
+    case OPERANDS_X_NN:  snprintf(out, size, info->mnemonic, x, opcode & 0xFF); break;
+    case OPERANDS_X_Y:   snprintf(out, size, info->mnemonic, x, y); break;
+    case OPERANDS_X_Y_N: snprintf(out, size, info->mnemonic, x, y, opcode & 0x0F); break;
     }
 }
-#endif
 
 void chip8_execute(Chip8* chip8)
 {
-    // Get next opcode from RAM
-    chip8->inst.opcode = (chip8->ram[chip8->PC] << 8) | (chip8->ram[chip8->PC + 1]);
+    const uint16_t pc = chip8->PC;
+    InstructionHandler handler;
+    DecodedInstruction* entry = NULL;
+
+    if (pc % 2 == 0) {
+        entry = pc < RAM_PAGE_SIZE ? &chip8->decoded[pc / 2] : chip8_decoded_high(chip8, pc);
+    }
+
+    if (entry) {
+        // Decode the instruction at this address on first use only
+        if (!entry->handler) {
+            const uint16_t opcode = (chip8->ram[pc] << 8) | (chip8->ram[pc + 1]);
+            entry->handler = chip8_decode(opcode, chip8->quirks, &entry->inst);
+        }
+
+        chip8->inst = entry->inst;
+        handler = entry->handler;
+    } else {
+        // Odd addresses are rare, decode them every time
+        const uint16_t opcode = (chip8->ram[pc % RAM_CAPACITY] << 8) |
+            (chip8->ram[(pc + 1) % RAM_CAPACITY]);
+        handler = chip8_decode(opcode, chip8->quirks, &chip8->inst);
+    }
 
     // Increment Program Counter for next opcode
     chip8->PC += 2;
 
-    // Fill out current instruction format
-    chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
-    chip8->inst.NN = chip8->inst.opcode & 0x0FF;
-    chip8->inst.N = chip8->inst.opcode & 0x0F;
-    chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
-    chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
+    PROFILE_INSTRUCTION(chip8, pc, chip8->inst.opcode);
+    TRACE_BEGIN(chip8, pc);
 
-    uint8_t flag = 0; // VF / Carry flag
+    // Emulate opcode
+    handler(chip8);
 
-#ifdef DEBUG
-    print_debug_info(chip8);
-#endif
+    TRACE_END(chip8);
+}
 
-    // Emulate opcode
-    switch (chip8->inst.opcode >> 12) {
-    case 0x00:
-        switch (chip8->inst.NN) {
-        case 0xE0:
-            // 0x00E0: Clear the screen
-            memset(&chip8->display[0], false, sizeof(chip8->display));
-            break;
+uint32_t chip8_fast_forward(Chip8* chip8, uint32_t remaining)
+{
+    // Called when control went back to or before the previous PC. Skips up
+    //  to remaining instructions of a loop that cannot change anything
+    //  before the next timer tick or keypad change, leaving the machine
+    //  exactly as running them would. Returns the number skipped.
+    const uint16_t pc = chip8->PC;
+    const uint16_t opcode = chip8_opcode_at(chip8, pc);
+    const uint8_t x = (opcode >> 8) & 0x0F;
+
+    chip8->idle = CHIP8_RUNNING;
+
+    // 1NNN reaches the first 4 KB only
+    const bool can_jump_here = pc < 0x1000;
+    const uint16_t jump_here = 0x1000 | pc;
+
+    if ((can_jump_here && opcode == jump_here) || opcode == 0x00FD) {
+        // 1NNN jumping to itself, or 00FD
+        chip8->idle = CHIP8_HALTED;
+        return remaining;
+    }
 
-        case 0xEE:
-            // 0x00EE: Return from a subroutine
-            // Pop last address from the stack
-            //  and set PC to it
-            chip8->PC = *--chip8->stack_ptr;
-            break;
+    if ((opcode & 0xF0FF) == 0xF00A) {
+        // FX0A re-executes itself while no key is pressed, or while the
+        //  key it latched is still held
+        bool pressed = false;
 
-        default:
-            // Not implemented
-            //   or 0x0NNN: Calls machine code routine at address NNN
-            break;
+        for (uint8_t i = 0; !chip8->waiting_release && i < sizeof(chip8->keypad); ++i) {
+            pressed |= chip8->keypad[i];
         }
-        break;
 
-    case 0x01:
-        // 0x1NNN: Jump to address NNN
-        chip8->PC = chip8->inst.NNN;
-        break;
+        if (chip8->waiting_release ? chip8->keypad[chip8->awaited_key] : !pressed) {
+            chip8->idle = CHIP8_WAIT_KEY;
+            return remaining;
+        }
 
-    case 0x02:
-        // 0x2NNN: Call subroutine at NNN
-        // Push PC in the stack and set PC
-        //   to the jump address
-        *chip8->stack_ptr++ = chip8->PC;
-        chip8->PC = chip8->inst.NNN;
-        break;
+        return 0;
+    }
 
-    case 0x03:
-        // 0x3XNN: Skip the next instruction if VX equals NN
-        if (chip8->V[chip8->inst.X] == chip8->inst.NN) {
-            chip8->PC += 2;
+    if ((opcode & 0xF0FF) == 0xF007) {
+        // FX07, 3XNN or 4XNN, 1NNN back to the FX07: polls the delay timer,
+        //  which only changes on a tick. Every pass sets VX to the timer
+        //  and loops again unless the skip is taken
+        const uint16_t skip = chip8_opcode_at(chip8, pc + 2);
+        const uint16_t jump = chip8_opcode_at(chip8, pc + 4);
+        const uint8_t nn = skip & 0xFF;
+        const bool equal = (skip & 0xFF00) == (0x3000 | x << 8);
+        const bool not_equal = (skip & 0xFF00) == (0x4000 | x << 8);
+
+        if (!can_jump_here || jump != jump_here || !(equal || not_equal) ||
+            (equal ? chip8->delay_timer == nn : chip8->delay_timer != nn)) {
+            return 0;
         }
-        break;
 
-    case 0x04:
-        // 0x4XNN: Skip the next instruction if VX does not equal NN
-        if (chip8->V[chip8->inst.X] != chip8->inst.NN) {
-            chip8->PC += 2;
-        }
-        break;
+        // Whole passes only, the rest runs normally
+        const uint32_t skipped = remaining - remaining % 3;
 
-    case 0x05:
-        // 0x5XY0: Skip the next instruction if VX equals VY
-        if (chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y]) {
-            chip8->PC += 2;
+        if (skipped > 0) {
+            chip8->V[x] = chip8->delay_timer;
         }
-        break;
 
-    case 0x06:
-        // 0x6XNN: Set VX to NN
-        chip8->V[chip8->inst.X] = chip8->inst.NN;
-        break;
+        chip8->idle = CHIP8_WAIT_TIMER;
+        return skipped;
+    }
 
-    case 0x07:
-        // 0x7XNN: Adds NN to VX (carry flag is not changed)
-        chip8->V[chip8->inst.X] += chip8->inst.NN;
-        break;
+    return 0;
+}
 
-    case 0x08:
-        switch (chip8->inst.N) {
-        case 0x0:
-            // 0x8XY0: Set VX to the value of VY
-            chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
-            break;
+uint32_t chip8_step(Chip8* chip8, uint32_t count)
+{
+    // Returns the instructions executed, fewer than count when the step
+    //  ended after an FX18 that turned the tone on or off
+    chip8->idle = CHIP8_RUNNING;
+    chip8->sound_edge = false;
 
-        case 0x1:
-            // 0x8XY1: Set VX to VX or VY (bitwise)
-            chip8->V[chip8->inst.X] |= chip8->V[chip8->inst.Y];
-            chip8->V[0xF] = 0; // TODO: This is only for the CHIP-8
-            break;
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint16_t pc = chip8->PC;
+        chip8_execute(chip8);
 
-        case 0x2:
-            // 0x8XY2: Set VX to VX and VY (bitwise)
-            chip8->V[chip8->inst.X] &= chip8->V[chip8->inst.Y];
-            chip8->V[0xF] = 0; // TODO: This is only for the CHIP-8
-            break;
+        if (chip8->sound_edge) {
+            return i + 1;
+        }
 
-        case 0x3:
-            // 0x8XY3: Set VX to VX xor VY
-            chip8->V[chip8->inst.X] ^= chip8->V[chip8->inst.Y];
-            chip8->V[0xF] = 0; // TODO: This is only for the CHIP-8
-            break;
+        // Only loops can idle, check on backward jumps
+        if (chip8->PC <= pc) {
+            i += chip8_fast_forward(chip8, count - i - 1);
+        }
+    }
 
-        case 0x4:
-            // 0x8XY4: Add VY to VX, set VF
-            flag = ((uint16_t)(chip8->V[chip8->inst.X] + chip8->V[chip8->inst.Y]) > 255);
+    return count;
+}
 
-            chip8->V[chip8->inst.X] += chip8->V[chip8->inst.Y];
-            chip8->V[0xF] = flag;
-            break;
+uint32_t chip8_instructions_to_tick(const Chip8* chip8)
+{
+    // Timers tick on the instruction that completes a 1/60 s period of
+    //  emulated time, so the tick rate does not depend on the host
+    return (chip8->ips - chip8->timer_phase + CHIP_TIMER_FREQUENCY - 1) / CHIP_TIMER_FREQUENCY;
+}
 
-        case 0x5:
-            // 0x8XY5: VY is subtracted from VX, set VF
-            flag = (chip8->V[chip8->inst.Y] <= chip8->V[chip8->inst.X]);
+bool chip8_advance_clock(Chip8* chip8, uint32_t executed)
+{
+    // executed must not exceed chip8_instructions_to_tick, returns true
+    //  when the timers are due and the caller has to tick them
+    chip8->timer_phase += executed * CHIP_TIMER_FREQUENCY;
 
-            chip8->V[chip8->inst.X] -= chip8->V[chip8->inst.Y];
-            chip8->V[0xF] = flag;
-            break;
+    if (chip8->timer_phase < chip8->ips) {
+        return false;
+    }
 
-        case 0x6:
-            // 0x8XY6: Stores the least significant bit of VX in VF
-            //   and then shifts VX to the right by 1
-            //
-            // CHIP-8 shifs the value in the register VY and stores the result in VX.
-            //   The CHIP-48 and SCHIP implementations instead ignored VY, and simply shifted VX
-            // TODO: Make this configurable
-            flag = chip8->V[chip8->inst.Y] & 1;
-
-            chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] >> 1;
-            chip8->V[0xF] = flag;
-            break;
+    chip8->timer_phase -= chip8->ips;
+    return true;
+}
+
+void chip8_tick_timers(Chip8* chip8)
+{
+    // Called at CHIP_TIMER_FREQUENCY
+    if (chip8->delay_timer > 0) {
+        chip8->delay_timer--;
+    }
 
-        case 0x7:
-            // 0x8XY7: Set VX to VY minus VX, set VF
-            flag = (chip8->V[chip8->inst.X] <= chip8->V[chip8->inst.Y]);
+    if (chip8->sound_timer > 0) {
+        chip8->sound_timer--;
+    }
+}
 
-            chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
-            chip8->V[0xF] = flag;
-            break;
+void chip8_set_key(Chip8* chip8, uint8_t key, bool pressed)
+{
+    if (key < sizeof(chip8->keypad)) {
+        chip8->keypad[key] = pressed;
 
-        case 0xE:
-            // 0x8XYE: Stores the most significant bit of VX in VF
-            //  and then shifts VX to the left by 1
-            //
-            // CHIP-8 shifs the value in the register VY and stores the result in VX.
-            //   The CHIP-48 and SCHIP implementations instead ignored VY, and simply shifted VX
-            // TODO: Make this configurable
-            flag = (chip8->V[chip8->inst.Y] & 0x80) >> 7;
-
-            chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] << 1;
-            chip8->V[0xF] = flag;
-            break;
+        // A machine waiting on FX0A may continue
+        chip8->idle = CHIP8_RUNNING;
+    }
+}
 
-        default:
-            // Not implemented or bad opcode
-            break;
+uint8_t chip8_get_pixel(const Chip8* chip8, uint8_t x, uint8_t y)
+{
+    // Bit n of the color is the pixel in plane n + 1
+    x %= chip8_display_width(chip8);
+    y %= chip8_display_height(chip8);
+    uint8_t color = 0;
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        color |= ((chip8->display[plane][y][x / 64] >> (63 - x % 64)) & 1) << plane;
+    }
+
+    return color;
+}
+
+uint64_t chip8_display_hash(const Chip8* chip8)
+{
+    // 64 bit FNV-1a over the visible rows, most significant byte first
+    //  so the hash does not depend on the host byte order. Plane 2 is only
+    //  hashed when it has pixels set, so a lo-res plane 1 display hashes
+    //  the same as the original 64x32 one
+    const uint8_t height = chip8_display_height(chip8);
+    const uint8_t words = chip8_display_width(chip8) / 64;
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        uint64_t lit = 0;
+
+        for (uint8_t y = 0; plane > 0 && y < height; ++y) {
+            for (uint8_t word = 0; word < words; ++word) {
+                lit |= chip8->display[plane][y][word];
+            }
         }
-        break;
-
-    case 0x09:
-        // 0x9XY0: Skip the next instruction if VX does not equal VY
-        if (chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y]) {
-            chip8->PC += 2;
-        }
-        break;
-
-    case 0x0A:
-        // 0xANNN: Set I to the address NNN
-        chip8->I = chip8->inst.NNN;
-        break;
-
-    case 0x0B:
-        // 0xBNNN: Jump to the address NNN plus V0
-        chip8->PC = chip8->inst.NNN + chip8->V[0];
-        break;
-
-    case 0x0C:
-        // 0xCXNN: Set VX to the result of a bitwise and operation
-        //  on a random number and NN
-        chip8->V[chip8->inst.X] = (rand() % 256) & chip8->inst.NN;
-        break;
-
-    case 0x0D:
-        // 0xDXYN: Draw a sprite at coordinate (VX, VY)
-        //  Read from memory location I.
-        //  VF (Carry flag) is set if any screen pixels are set off
-        uint8_t x_coord = chip8->V[chip8->inst.X] % WINDOW_WIDTH;
-        uint8_t y_coord = chip8->V[chip8->inst.Y] % WINDOW_HEIGHT;
-        const uint8_t orig_x = x_coord; // Original X value
-
-        chip8->V[0xF] = 0; // Initialize Carry flag
-
-        for (uint8_t i = 0; i < chip8->inst.N; ++i) {
-            // Get next byte / row of sprite data
-            const uint8_t sprite_data = chip8->ram[chip8->I + i];
-            x_coord = orig_x; // Reset X for next row to draw
-
-            for (int8_t j = 7; j >= 0; j--) {
-                bool* pixel = &chip8->display[y_coord * WINDOW_WIDTH + x_coord];
-                const bool sprite_bit = sprite_data & (1 << j);
-
-                // If sprite pixel / bit is on and display pixel is on, set carry flag
-                if (sprite_bit && *pixel) {
-                    chip8->V[0xF] = 1;
-                }
 
-                // XOR display pixel with sprite pixel / bit
-                *pixel ^= sprite_bit;
+        if (plane > 0 && !lit) {
+            continue;
+        }
 
-                // Stop drawing if hit right edge of the screen
-                if (++x_coord >= WINDOW_WIDTH) {
-                    break;
+        for (uint8_t y = 0; y < height; ++y) {
+            for (uint8_t word = 0; word < words; ++word) {
+                for (int8_t shift = 56; shift >= 0; shift -= 8) {
+                    hash ^= (chip8->display[plane][y][word] >> shift) & 0xFF;
+                    hash *= 0x100000001B3;
                 }
             }
+        }
+    }
+
+    return hash;
+}
+
+static uint8_t* state_put16(uint8_t* out, uint16_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static uint8_t* state_put64(uint8_t* out, uint64_t value)
+{
+    // Spelled out so the compiler merges the bytes into one store
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+    out[4] = value >> 32;
+    out[5] = value >> 40;
+    out[6] = value >> 48;
+    out[7] = value >> 56;
+    return out + 8;
+}
 
-            // Stop drawing sprite if hit bottom edge of screen
-            if (++y_coord >= WINDOW_HEIGHT) {
-                break;
+static const uint8_t* state_get16(const uint8_t* in, uint16_t* value)
+{
+    *value = in[0] | (in[1] << 8);
+    return in + 2;
+}
+
+static const uint8_t* state_get64(const uint8_t* in, uint64_t* value)
+{
+    // Spelled out so the compiler merges the bytes into one load
+    *value = (uint64_t)in[0] | (uint64_t)in[1] << 8 | (uint64_t)in[2] << 16 |
+        (uint64_t)in[3] << 24 | (uint64_t)in[4] << 32 | (uint64_t)in[5] << 40 |
+        (uint64_t)in[6] << 48 | (uint64_t)in[7] << 56;
+    return in + 8;
+}
+
+size_t chip8_save_state(const Chip8* chip8, uint8_t* buffer, size_t size)
+{
+    // Little endian fields in a fixed order and the RAM in use last,
+    //  returns the state's size or 0 if buffer is too small
+    if (size < CHIP8_STATE_FIXED_SIZE + chip8->ram_size) {
+        return 0;
+    }
+
+    uint8_t* out = buffer;
+    memcpy(out, "C8ST", 4);
+    out = state_put16(out + 4, CHIP8_STATE_VERSION);
+
+    *out++ = chip8->quirks;
+    *out++ = chip8->stack_ptr - chip8->stack;
+    *out++ = chip8->waiting_release;
+    *out++ = chip8->awaited_key;
+    *out++ = chip8->hires;
+    *out++ = chip8->planes;
+
+    memcpy(out, chip8->V, sizeof(chip8->V));
+    out += sizeof(chip8->V);
+
+    out = state_put16(out, chip8->I);
+    out = state_put16(out, chip8->PC);
+    *out++ = chip8->delay_timer;
+    *out++ = chip8->sound_timer;
+    out = state_put16(out, chip8->timer_phase);
+    out = state_put16(out, chip8->ips);
+
+    uint16_t keys = 0;
+    for (uint8_t i = 0; i < sizeof(chip8->keypad); ++i) {
+        keys |= chip8->keypad[i] << i;
+    }
+
+    out = state_put16(out, keys);
+    out = state_put64(out, chip8->rng_state);
+
+    for (uint8_t i = 0; i < 12; ++i) {
+        out = state_put16(out, chip8->stack[i]);
+    }
+
+    memcpy(out, chip8->flags, sizeof(chip8->flags));
+    out += sizeof(chip8->flags);
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        for (uint8_t y = 0; y < HIRES_HEIGHT; ++y) {
+            for (uint8_t word = 0; word < DISPLAY_ROW_WORDS; ++word) {
+                out = state_put64(out, chip8->display[plane][y][word]);
             }
         }
-        break;
+    }
 
-    case 0x0E:
-        switch (chip8->inst.NN) {
-        case 0x9E:
-            // 0xEX9E: Skip the next instruction if the key stored in VX is pressed
-            if (chip8->keypad[chip8->V[chip8->inst.X]]) {
-                chip8->PC += 2;
-            }
-            break;
+    *out++ = chip8->ram_size / RAM_PAGE_SIZE - 1;
+    memcpy(out, chip8->ram, chip8->ram_size);
+    out += chip8->ram_size;
 
-        case 0xA1:
-            // 0xEXA1: Skips the next instruction if the key stored in VX is not pressed
-            if (!chip8->keypad[chip8->V[chip8->inst.X]]) {
-                chip8->PC += 2;
-            }
-            break;
+    return out - buffer;
+}
 
-        default:
-            break; // Not implemented or invalid opcode
-        }
-        break;
+bool chip8_load_state(Chip8* chip8, const uint8_t* buffer, size_t size)
+{
+    uint16_t version;
 
-    case 0x0F:
-        switch (chip8->inst.NN) {
-        case 0x07:
-            // 0xFX07: Set VX to the value of the delay timer
-            chip8->V[chip8->inst.X] = chip8->delay_timer;
-            break;
+    if (size < CHIP8_STATE_FIXED_SIZE || memcmp(buffer, "C8ST", 4) != 0) {
+        fprintf(stderr, "ERROR: Not a CHIP-8 save state\n");
+        return false;
+    }
 
-        case 0x0A:
-            // 0xFX0A: A key press is awaited, and then stored in VX (blocking operation)
-            static bool key_pressed = false;
-            static uint8_t key = 0xFF;
-            for (uint8_t i = 0; key == 0xFF && i < sizeof(chip8->keypad); ++i) {
-                if (chip8->keypad[i]) {
-                    key = i;
-                    key_pressed = true;
-                    break;
-                }
-            }
+    const uint8_t* in = state_get16(buffer + 4, &version);
 
-            if (!key_pressed) {
-                // Keep running this instruction until a key is pressed
-                chip8->PC -= 2;
-            } else {
-                // A key is pressed, wait until the key is released
-                if (chip8->keypad[key]) {
-                    chip8->PC -= 2;
-                } else {
-                    chip8->V[chip8->inst.X] = key;
-                    key = 0xFF;
-                    key_pressed = false;
-                }
-            }
-            break;
+    if (version != CHIP8_STATE_VERSION) {
+        fprintf(stderr, "ERROR: Unsupported save state version %u\n", version);
+        return false;
+    }
 
-        case 0x15:
-            // 0xFX15: Set the delay timer to VX
-            chip8->delay_timer = chip8->V[chip8->inst.X];
-            break;
+    const uint8_t quirks = in[0];
+    const uint8_t stack_index = in[1];
 
-        case 0x18:
-            // 0xFX18: Set the sound timer to VX
-            chip8->sound_timer = chip8->V[chip8->inst.X];
-            break;
+    // The clock follows the timers, 6 + V + I + PC + timers ahead
+    uint16_t timer_phase;
+    uint16_t ips;
+    state_get16(state_get16(in + 6 + 16 + 2 + 2 + 2, &timer_phase), &ips);
 
-        case 0x1E:
-            // 0xFX1E: Add VX to I. VF is not affected.
-            // CHIP-8 interpreter for the Commodore Amiga sets VF to 1
-            //   when there is a range overflow (I+VX>0xFFF)
-            // TODO: Make setting VF configurable
-            chip8->I += chip8->V[chip8->inst.X];
-            break;
+    // The RAM follows the page count that ends the fixed fields
+    const uint32_t ram_size = (buffer[CHIP8_STATE_FIXED_SIZE - 1] + 1) * RAM_PAGE_SIZE;
 
-        case 0x29:
-            // 0xFX29: Set I to the location of the sprite for the character in VX.
-            //   Characters 0-F (in hexadecimal) are represented by a 4x5 font
-            chip8->I = chip8->V[chip8->inst.X] * 5;
-            break;
+    // Check everything used as an index or divisor before touching the machine
+    if (stack_index > 12 || in[3] >= sizeof(chip8->keypad) || in[5] > 0x03 ||
+        ips < CHIP_MIN_INST_PER_SECOND || ips > CHIP_MAX_INST_PER_SECOND || timer_phase >= ips ||
+        ram_size > RAM_CAPACITY || size < CHIP8_STATE_FIXED_SIZE + ram_size) {
+        fprintf(stderr, "ERROR: Corrupt save state\n");
+        return false;
+    }
 
-        case 0x33:
-            // 0xFX33: Stores the BCD representation of VX,
-            //   with the hundreds digit in memory at location in I, the tens
-            //   digit at location I+1, and the ones digit at location I+2
-            uint8_t bcd = chip8->V[chip8->inst.X];
-
-            chip8->ram[chip8->I + 2] = bcd % 10;
-            bcd /= 10;
-            chip8->ram[chip8->I + 1] = bcd % 10;
-            bcd /= 10;
-            chip8->ram[chip8->I] = bcd;
-            break;
+    chip8->stack_ptr = &chip8->stack[stack_index];
+    chip8->waiting_release = in[2];
+    chip8->awaited_key = in[3];
+    chip8->hires = in[4] != 0;
+    chip8->planes = in[5];
+    in += 6;
 
-        case 0x55:
-            // 0xFX55: Stores from V0 to VX (including VX) in memory, starting at address I.
-            //   CHIP-8 increments I, SCHIP does not
-            // TODO: Make this configurable
-            for (uint8_t i = 0; i <= chip8->inst.X; ++i) {
-                chip8->ram[chip8->I] = chip8->V[i];
-                chip8->I++;
-            }
-            break;
+    memcpy(chip8->V, in, sizeof(chip8->V));
+    in += sizeof(chip8->V);
 
-        case 0x65:
-            // 0xFX65: Stores from V0 to VX (including VX) in memory, starting at address I.
-            //   CHIP-8 increments I, SCHIP does not
-            // TODO: Make this configurable
-            for (uint8_t i = 0; i <= chip8->inst.X; ++i) {
-                chip8->V[i] = chip8->ram[chip8->I];
-                chip8->I++;
+    in = state_get16(in, &chip8->I);
+    in = state_get16(in, &chip8->PC);
+    chip8->delay_timer = *in++;
+    chip8->sound_timer = *in++;
+    in = state_get16(in, &chip8->timer_phase);
+    in = state_get16(in, &chip8->ips);
+
+    uint16_t keys;
+    in = state_get16(in, &keys);
+
+    for (uint8_t i = 0; i < sizeof(chip8->keypad); ++i) {
+        chip8->keypad[i] = (keys >> i) & 1;
+    }
+
+    in = state_get64(in, &chip8->rng_state);
+
+    for (uint8_t i = 0; i < 12; ++i) {
+        in = state_get16(in, &chip8->stack[i]);
+    }
+
+    memcpy(chip8->flags, in, sizeof(chip8->flags));
+    in += sizeof(chip8->flags);
+
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        for (uint8_t y = 0; y < HIRES_HEIGHT; ++y) {
+            for (uint8_t word = 0; word < DISPLAY_ROW_WORDS; ++word) {
+                in = state_get64(in, &chip8->display[plane][y][word]);
             }
-            break;
+        }
+    }
+
+    in++; // Page count
+
+    chip8->idle = CHIP8_RUNNING;
+
+    if (quirks != chip8->quirks) {
+        // Cached handlers were selected for other quirks
+        memset(chip8->decoded, 0, sizeof(chip8->decoded));
 
-        default:
-            break; // Not implemented or invalid opcode
+        if (chip8->decoded_high) {
+            memset(chip8->decoded_high, 0,
+                (RAM_CAPACITY - RAM_PAGE_SIZE) / 2 * sizeof(DecodedInstruction));
         }
-        break;
 
-    default:
-        break; // Not implemented or invalid opcode
+        chip8->quirks = quirks;
+    }
+
+    // Only drop predecoded instructions whose bytes actually change,
+    //  compared 8 bytes (4 instructions) at a time. RAM the machine used
+    //  past the state's goes back to zeros
+    static const uint8_t zeros[8];
+    const uint32_t end = ram_size > chip8->ram_size ? ram_size : chip8->ram_size;
+
+    for (uint32_t i = 0; i < end; i += 8) {
+        const uint8_t* bytes = i < ram_size ? &in[i] : zeros;
+
+        if (memcmp(&chip8->ram[i], bytes, 8) != 0) {
+            memcpy(&chip8->ram[i], bytes, 8);
+
+            for (uint32_t j = i; j < i + 8; j += 2) {
+                chip8_drop_decoded(chip8, j);
+            }
+        }
     }
+
+    chip8->ram_size = ram_size;
+
+    return true;
 }
 
+bool chip8_save_state_file(const Chip8* chip8, const char* path)
+{
+    uint8_t state[CHIP8_STATE_SIZE];
+    const size_t size = chip8_save_state(chip8, state, sizeof(state));
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open save state \"%s\"\n", path);
+        return false;
+    }
+
+    const bool ok = fwrite(state, size, 1, file) == 1;
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not write save state \"%s\"\n", path);
+    }
+
+    return ok;
+}
+
+bool chip8_load_state_file(Chip8* chip8, const char* path)
+{
+    uint8_t state[CHIP8_STATE_SIZE];
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open save state \"%s\"\n", path);
+        return false;
+    }
+
+    const size_t size = fread(state, 1, sizeof(state), file);
+    fclose(file);
+
+    return chip8_load_state(chip8, state, size);
+}
@@ -3,19 +3,64 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 // Original CHIP-8 resolution
 #define WINDOW_WIDTH 64
 #define WINDOW_HEIGHT 32
 
-#define FOREGROUND_COLOR 0xFFFFFFFF
+// SUPER-CHIP hi-res resolution, 00FF/00FE switch between the two
+#define HIRES_WIDTH 128
+#define HIRES_HEIGHT 64
+
+// XO-CHIP bitplanes, a pixel's color is its bit in each plane
+#define DISPLAY_PLANES 2
+#define DISPLAY_ROW_WORDS (HIRES_WIDTH / 64)
+
+#define FOREGROUND_COLOR 0xFFFFFFFF // Plane 1
+#define PLANE2_COLOR 0xAAAAAAFF     // Plane 2
+#define OVERLAP_COLOR 0x555555FF    // Both planes
 #define BACKGROUND_COLOR 0x000000FF
 
-#define RAM_CAPACITY 4096
+// XO-CHIP 16 bit address space, the program still starts at 0x200.
+//   CHIP-8 and SUPER-CHIP only use the first page
+#define RAM_CAPACITY 0x10000
+#define RAM_PAGE_SIZE 0x1000
 #define CHIP_ENTRY_POINT 0x200
-#define MAX_ROM_SIZE RAM_CAPACITY - CHIP_ENTRY_POINT
+#define MAX_ROM_SIZE (RAM_CAPACITY - CHIP_ENTRY_POINT)
+
+// 8x10 SUPER-CHIP digits, stored after the 4x5 font
+#define BIG_FONT_ADDRESS 0x50
+
+// Serialized machine state, see chip8_save_state. Only the RAM in use is
+//   stored, CHIP8_STATE_SIZE is the largest state
+#define CHIP8_STATE_VERSION 3
+#define CHIP8_STATE_FIXED_SIZE (4 + 2 + 6 + 16 + 2 + 2 + 1 + 1 + 2 + 2 + 2 + 8 + 12 * 2 + 16 + \
+    DISPLAY_PLANES * HIRES_HEIGHT * DISPLAY_ROW_WORDS * 8 + 1)
+#define CHIP8_STATE_SIZE (CHIP8_STATE_FIXED_SIZE + RAM_CAPACITY)
+
+#define CHIP_INST_PER_SECOND 500 // Hz (CHIP-8 "clock rate"), default of chip8_set_speed
+#define CHIP_TIMER_FREQUENCY 60  // Hz (delay and sound timers)
+
+// Clock rates accepted by chip8_set_speed, at least one instruction per
+//  timer tick and 1000 per frame at most
+#define CHIP_MIN_INST_PER_SECOND CHIP_TIMER_FREQUENCY
+#define CHIP_MAX_INST_PER_SECOND 60000
+
+// Behaviours that differ between CHIP-8 implementations
+typedef enum Quirk
+{
+    QUIRK_VF_RESET = 1 << 0,           // 8XY1/8XY2/8XY3 reset VF
+    QUIRK_SHIFT_VY = 1 << 1,           // 8XY6/8XYE shift VY instead of VX
+    QUIRK_MEMORY_INCREMENT_I = 1 << 2, // FX55/FX65 leave I past the last register
+    QUIRK_FX1E_OVERFLOW = 1 << 3       // FX1E sets VF when I goes past 0xFFF
+} Quirk;
 
-#define CHIP_INST_PER_SECOND 500 // Hz (CHIP-8 "clock rate")
+// Quirk profiles of well known implementations
+#define QUIRKS_CHIP8 (QUIRK_VF_RESET | QUIRK_SHIFT_VY | QUIRK_MEMORY_INCREMENT_I)
+#define QUIRKS_SCHIP 0
+#define QUIRKS_AMIGA (QUIRKS_CHIP8 | QUIRK_FX1E_OVERFLOW)
+#define QUIRKS_XOCHIP (QUIRK_SHIFT_VY | QUIRK_MEMORY_INCREMENT_I)
 
 typedef struct Instruction
 {
@@ -27,10 +72,45 @@ typedef struct Instruction
     uint8_t Y;    // 4 bit register identifier
 } Instruction;
 
-typedef struct Chip8
+// What the machine was doing when the last chip8_step ended, set when
+//  chip8_fast_forward skipped instructions
+typedef enum Chip8Idle
+{
+    CHIP8_RUNNING = 0,
+    CHIP8_WAIT_TIMER, // Polling the delay timer, runs again after the next tick
+    CHIP8_WAIT_KEY,   // FX0A, runs again after a keypad change
+    CHIP8_HALTED      // Jumping to itself forever or exited (00FD)
+} Chip8Idle;
+
+typedef struct Chip8 Chip8;
+
+#ifdef PROFILE
+typedef struct Profile Profile;
+#endif
+
+#ifdef DEBUG
+typedef struct Trace Trace;
+#endif
+
+// Emulates a single decoded instruction held in Chip8.inst
+typedef void (*InstructionHandler)(Chip8* chip8);
+
+typedef struct DecodedInstruction
+{
+    InstructionHandler handler; // NULL until the address is first executed
+    Instruction inst;
+} DecodedInstruction;
+
+struct Chip8
 {
     uint8_t ram[RAM_CAPACITY];
-    bool display[WINDOW_WIDTH * WINDOW_HEIGHT];
+    uint32_t ram_size;   // Whole pages up to the highest byte loaded or written, zeros past it
+
+    // Per plane rows of packed words, bit 63 of word 0 is the leftmost
+    //   pixel. Lo-res uses word 0 of the first WINDOW_HEIGHT rows
+    uint64_t display[DISPLAY_PLANES][HIRES_HEIGHT][DISPLAY_ROW_WORDS];
+    bool hires;          // 128x64 SUPER-CHIP mode
+    uint8_t planes;      // Planes drawn, cleared and scrolled, bit 0 is plane 1 (FN01)
     uint16_t stack[12];  // Subroutine stack
     uint16_t* stack_ptr;
 
@@ -40,14 +120,69 @@ typedef struct Chip8
 
     uint8_t delay_timer; // Decrements at 60 Hz when above 0
     uint8_t sound_timer; // Decrements at 60 Hz and plays tone when above 0
+    uint16_t timer_phase; // Instructions since the last timer tick, times CHIP_TIMER_FREQUENCY
+    uint16_t ips;        // Instructions per second of emulated time
 
     bool keypad[16];     // Hexadecimal keypad 0x0-0xF
 
+    uint8_t quirks;      // Quirk flags, fixed for the lifetime of a run
+
+    uint64_t rng_state;  // xorshift64* state used by CXNN, never 0
+
+    uint8_t flags[16];   // SUPER-CHIP RPL user flags (FX75/FX85)
+
+    bool waiting_release; // FX0A: awaited_key is pressed, wait for its release
+    uint8_t awaited_key;
+
+    uint8_t idle;        // Chip8Idle, not part of save states
+    bool sound_edge;     // FX18 turned the tone on or off, the step ended after it
+
     Instruction inst;    // Currently executing instruction
-} Chip8;
 
-bool chip8_init(Chip8* chip8, const char* rom_path);
+    // Predecoded instructions, one per even RAM address.
+    //   Entries are filled lazily and dropped when their bytes are written.
+    //   The rest of the XO-CHIP space is allocated once code runs there
+    DecodedInstruction decoded[RAM_PAGE_SIZE / 2];
+    DecodedInstruction* decoded_high;
+
+#ifdef PROFILE
+    Profile* profile;    // Execution counts, NULL when not profiled
+#endif
+
+#ifdef DEBUG
+    Trace* trace;        // Recent instructions, NULL when not tracing
+#endif
+};
+
+// A Chip8 starts zeroed (static or calloc) and is released with chip8_cleanup
+bool chip8_init(Chip8* chip8, const char* rom_path, uint8_t quirks);
+bool chip8_init_rom(Chip8* chip8, const uint8_t* rom, size_t rom_size, uint8_t quirks);
+bool chip8_read_rom(const char* rom_path, uint8_t* buffer, size_t* size);
+bool chip8_quirks_from_name(const char* name, uint8_t* quirks);
+void chip8_cleanup(const Chip8* chip8);
+void chip8_seed(Chip8* chip8, uint64_t seed);
+bool chip8_set_speed(Chip8* chip8, uint16_t ips);
 void chip8_execute(Chip8* chip8);
+const char* chip8_opcode_name(uint16_t opcode);
+void chip8_disassemble(uint16_t opcode, char* out, size_t size);
+
+// Stepping API for embedding the core without a frontend
+uint32_t chip8_step(Chip8* chip8, uint32_t count);
+uint32_t chip8_fast_forward(Chip8* chip8, uint32_t remaining);
+void chip8_tick_timers(Chip8* chip8);
+uint32_t chip8_instructions_to_tick(const Chip8* chip8);
+bool chip8_advance_clock(Chip8* chip8, uint32_t executed);
+void chip8_set_key(Chip8* chip8, uint8_t key, bool pressed);
+uint8_t chip8_display_width(const Chip8* chip8);
+uint8_t chip8_display_height(const Chip8* chip8);
+uint8_t chip8_get_pixel(const Chip8* chip8, uint8_t x, uint8_t y);
+uint64_t chip8_display_hash(const Chip8* chip8);
+
+// Save states, a blob of at most CHIP8_STATE_SIZE bytes independent of the host
+size_t chip8_save_state(const Chip8* chip8, uint8_t* buffer, size_t size);
+bool chip8_load_state(Chip8* chip8, const uint8_t* buffer, size_t size);
+bool chip8_save_state_file(const Chip8* chip8, const char* path);
+bool chip8_load_state_file(Chip8* chip8, const char* path);
 
 #endif // _CHIP_H_
 
@@ -1,8 +1,202 @@
 #include "emu.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-bool emu_init(Emulator* emu, const char* rom_file)
+#include "profile.h"
+
+#ifdef CHIP8_AOT
+#include "aot.h"
+#endif
+
+static void emu_select_aot(Emulator* emu)
+{
+#ifdef CHIP8_AOT
+    emu->use_aot = chip8_aot_matches(&emu->chip8);
+
+    if (!emu->use_aot) {
+        fprintf(stderr, "WARNING: ROM differs from the translated one, using the interpreter\n");
+    }
+#else
+    emu->use_aot = false;
+#endif
+}
+
+static void emu_resync_clock(Emulator* emu)
+{
+    // Forget time spent while the scheduler was not running
+    emu->last_counter = SDL_GetPerformanceCounter();
+    emu->next_frame = emu->last_counter;
+    emu->report_counter = emu->last_counter;
+    emu->executed = 0;
+}
+
+static void emu_apply_key(Emulator* emu, const InputEvent* event)
+{
+    emu_set_key(emu, event->key, event->pressed);
+
+    // Presses while paused cannot show before resuming, they are not measured
+    if (emu->state != STATE_PAUSED) {
+        input_applied(&emu->input, event);
+    }
+}
+
+static void emu_flush_input(Emulator* emu)
+{
+    // Apply every queued keypad event now, for paths that do not follow
+    //  real time or are about to replace the machine state
+    InputEvent event;
+
+    while (input_pop(&emu->input, &event)) {
+        emu_apply_key(emu, &event);
+    }
+}
+
+static void emu_queue_key(Emulator* emu, const SDL_Event* event, uint64_t counter, uint8_t key,
+    bool pressed)
+{
+    // Render thread. Key repeat changes nothing on the keypad
+    if (event->key.repeat) {
+        return;
+    }
+
+    const InputEvent input = {
+        .counter = counter,
+        .key = key,
+        .pressed = pressed
+    };
+
+    // The emulation thread drains the queue even while paused or asleep,
+    //  it only fills up if that thread hangs
+    if (input_push(&emu->input, &input)) {
+        SDL_SemPost(emu->wake);
+    }
+}
+
+static bool emu_restore(Emulator* emu, const uint8_t* state, size_t size)
+{
+    emu_flush_input(emu);
+
+    // A movie only holds input, it cannot jump to another state. It ends
+    //  in the state from before the restore
+    if (emu->record_file) {
+        puts("INFO: Restoring a state, recording stopped");
+        emu_stop_recording(emu);
+    }
+
+    const uint16_t ips = emu->chip8.ips;
+
+    if (!chip8_load_state(&emu->chip8, state, size)) {
+        return false;
+    }
+
+    // Audio is queued from instructions at one clock rate, emulated time
+    //  starts over at another like after loading a ROM
+    if (emu->chip8.ips != ips) {
+        emu->instructions = 0;
+        emu->audio_samples = 0;
+        emu->inst_budget = 0;
+    }
+
+    // Compiled and translated code may no longer match RAM
+    if (emu->use_jit) {
+        jit_flush(&emu->jit);
+    }
+
+    emu_select_aot(emu);
+
+    return true;
+}
+
+static void emu_quick_save(Emulator* emu)
+{
+    // Keep a copy in memory and next to the ROM for later sessions
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.state", emu->rom_file);
+
+    chip8_save_state(&emu->chip8, emu->quick_save, sizeof(emu->quick_save));
+    emu->has_quick_save = true;
+
+    if (chip8_save_state_file(&emu->chip8, path)) {
+        printf("INFO: Saved state to \"%s\"\n", path);
+    }
+}
+
+static void emu_quick_load(Emulator* emu)
+{
+    size_t size = sizeof(emu->quick_save);
+
+    // Without a save from this session, fall back to the file. It is only
+    //  read here, the machine changes in emu_restore like for any state
+    if (!emu->has_quick_save) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.state", emu->rom_file);
+
+        FILE* file = fopen(path, "rb");
+
+        if (!file) {
+            fprintf(stderr, "ERROR: Could not open save state \"%s\"\n", path);
+            return;
+        }
+
+        size = fread(emu->quick_save, 1, sizeof(emu->quick_save), file);
+        fclose(file);
+    }
+
+    if (emu_restore(emu, emu->quick_save, size)) {
+        emu->has_quick_save = true;
+        puts("INFO: Loaded state");
+    }
+}
+
+static void emu_update_grid(Emulator* emu, uint32_t color)
+{
+    // Outline every lo-res pixel in the background color, the inside stays
+    //  transparent. Hi-res pixels are too small for outlines
+    const int width = WINDOW_WIDTH * WINDOW_SCALE;
+    const int height = WINDOW_HEIGHT * WINDOW_SCALE;
+    uint32_t* outline = calloc(width * height, sizeof(uint32_t));
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const int cell_x = x % WINDOW_SCALE;
+            const int cell_y = y % WINDOW_SCALE;
+
+            if (cell_x == 0 || cell_x == WINDOW_SCALE - 1 || cell_y == 0 || cell_y == WINDOW_SCALE - 1) {
+                outline[y * width + x] = color;
+            }
+        }
+    }
+
+    SDL_UpdateTexture(emu->grid, NULL, outline, width * sizeof(uint32_t));
+    free(outline);
+
+    emu->grid_color = color;
+    emu->redraw = true;
+}
+
+bool emu_init_textures(Emulator* emu)
+{
+    // Pixels are written as 0xRRGGBBAA, the same layout as the color defines
+    emu->screen = SDL_CreateTexture(emu->renderer, SDL_PIXELFORMAT_RGBA8888,
+        SDL_TEXTUREACCESS_STREAMING, HIRES_WIDTH, HIRES_HEIGHT);
+
+    emu->grid = SDL_CreateTexture(emu->renderer, SDL_PIXELFORMAT_RGBA8888,
+        SDL_TEXTUREACCESS_STATIC, WINDOW_WIDTH * WINDOW_SCALE, WINDOW_HEIGHT * WINDOW_SCALE);
+
+    if (!emu->screen || !emu->grid) {
+        SDL_Log("Could not initialize SDL textures: %s", SDL_GetError());
+        return false;
+    }
+
+    SDL_SetTextureBlendMode(emu->grid, SDL_BLENDMODE_BLEND);
+    emu_update_grid(emu, emu->palette[0]);
+
+    return true;
+}
+
+static bool emu_init_sdl(Emulator* emu)
 {
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) {
@@ -11,7 +205,7 @@ bool emu_init(Emulator* emu, const char* rom_file)
     }
 
     emu->window = SDL_CreateWindow(
-        "CHIP-8 Emulator",
+        WINDOW_TITLE,
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
         WINDOW_WIDTH * WINDOW_SCALE, WINDOW_HEIGHT * WINDOW_SCALE,
         0);
@@ -21,199 +215,938 @@ bool emu_init(Emulator* emu, const char* rom_file)
         return false;
     }
 
-    emu->renderer = SDL_CreateRenderer(emu->window, -1, SDL_RENDERER_ACCELERATED);
+    const uint32_t flags = SDL_RENDERER_ACCELERATED | (emu->vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+    emu->renderer = SDL_CreateRenderer(emu->window, -1, flags);
 
     if (!emu->renderer) {
         SDL_Log("Could not initialize SDL renderer: %s", SDL_GetError());
         return false;
     }
 
+    emu->wake = SDL_CreateSemaphore(0);
+    emu->frame_event = SDL_RegisterEvents(2);
+
+    if (!emu->wake || emu->frame_event == (uint32_t)-1) {
+        SDL_Log("Could not initialize SDL thread signals: %s", SDL_GetError());
+        return false;
+    }
+
+    return emu_init_textures(emu);
+}
+
+bool emu_load_rom(Emulator* emu, uint32_t index)
+{
+    // Start a library ROM from its pristine state, the window, audio
+    //  device and JIT buffer stay as they are
+    const RomImage* rom = &emu->library->roms[index];
+    RomProfile profile;
+
+    if (romdb_lookup(emu->db, rom->hash, &profile)) {
+        printf("INFO: Found \"%s\" in the ROM database, %s at %u IPS\n",
+            profile.name, romdb_platform_name(profile.platform), profile.ips);
+    } else {
+        // Logged as a list line for data/chip8db.txt
+        char hash[ROMDB_HASH_SIZE * 2 + 1];
+        romdb_format_hash(rom->hash, hash);
+        printf("INFO: ROM not in the ROM database, using defaults: %s %s\n",
+            hash, romdb_platform_name(profile.platform));
+    }
+
+    // Settings given on the command line win over the database
+    const uint8_t quirks = emu->quirks_given ? emu->quirks : profile.quirks;
+    const uint16_t ips = emu->ips ? emu->ips : profile.ips;
+
+    // Reject the ROM before anything of the running one is replaced
+    if (rom->size > MAX_ROM_SIZE) {
+        fprintf(stderr, "ERROR: ROM size too big\n");
+        return false;
+    }
+
+    if (ips < CHIP_MIN_INST_PER_SECOND || ips > CHIP_MAX_INST_PER_SECOND) {
+        fprintf(stderr, "ERROR: Speed must be %d to %d instructions per second\n",
+            CHIP_MIN_INST_PER_SECOND, CHIP_MAX_INST_PER_SECOND);
+        return false;
+    }
+
+    // A movie only describes one ROM, a profile too
+    emu_flush_input(emu);
+    emu_stop_recording(emu);
+
+#ifdef PROFILE
+    const bool profiling = emu->chip8.profile != NULL;
+    PROFILE_FINISH(&emu->chip8, emu->rom_file);
+#endif
+
+#ifdef DEBUG
+    Trace* trace = emu->chip8.trace;
+#endif
+
+    if (!chip8_init_rom(&emu->chip8, library_image(emu->library, index), rom->size, quirks)) {
+        return false;
+    }
+
+#ifdef DEBUG
+    emu->chip8.trace = trace;
+#endif
+
+#ifdef PROFILE
+    if (profiling) {
+        PROFILE_START(&emu->chip8);
+    }
+#endif
+
+    chip8_seed(&emu->chip8, emu->seed);
+
+    if (!chip8_set_speed(&emu->chip8, ips)) {
+        return false;
+    }
+
+    chip8_save_state(&emu->chip8, emu->pristine, sizeof(emu->pristine));
+    emu->has_quick_save = false;
+    emu->rom = index;
+    emu->rom_file = library_name(emu->library, index);
+
+    // Emulated time starts over at the new clock rate
+    emu->instructions = 0;
+    emu->audio_samples = 0;
+    emu->inst_budget = 0;
+
+    // Reaches the window with the next published frame
+    memcpy(emu->palette, profile.palette, sizeof(emu->palette));
+
+    if (emu->use_jit) {
+        jit_flush(&emu->jit);
+    }
+
+    if (emu->use_rewind) {
+        rewind_clear(&emu->rewind);
+    }
+
+    emu_select_aot(emu);
+
+    return true;
+}
+
+static void emu_switch_rom(Emulator* emu, int32_t step)
+{
+    const uint32_t count = emu->library->count;
+
+    if (count < 2) {
+        return;
+    }
+
+    const uint32_t index = (emu->rom + count + step) % count;
+
+    if (!emu_load_rom(emu, index)) {
+        fprintf(stderr, "ERROR: Could not switch to \"%s\", still running \"%s\"\n",
+            library_name(emu->library, index), emu->rom_file);
+        return;
+    }
+
+    printf("INFO: Switched to \"%s\" (%u of %u)\n", emu->rom_file, index + 1, count);
+    emu_resync_clock(emu);
+}
+
+bool emu_init(Emulator* emu, EmulatorConfig config)
+{
+    emu->headless = config.headless;
+    emu->vsync = config.vsync;
+    emu->turbo = config.turbo;
+    emu->library = config.library;
+    emu->db = config.db;
+    emu->seed = config.seed;
+    emu->quirks = config.quirks;
+    emu->quirks_given = config.quirks_given;
+    emu->ips = config.ips;
+    input_init(&emu->input);
+    frame_buffer_init(&emu->frames);
+    atomic_init(&emu->frame_posted, false);
+    atomic_init(&emu->command_head, 0);
+    atomic_init(&emu->command_tail, 0);
+
+    if (!emu->headless && !emu_init_sdl(emu)) {
+        return false;
+    }
+
     // Initialize emulator components
-    if (!chip8_init(&emu->chip8, rom_file)) {
+    if (!emu_load_rom(emu, config.rom)) {
         fprintf(stderr, "ERROR: Could not initialize CHIP-8\n");
         return false;
     }
 
-    if (!audio_init(&emu->audio)) {
+    if (config.record_file) {
+        movie_start(&emu->movie, &emu->chip8, config.seed);
+        emu->record_file = config.record_file;
+    }
+
+    if (config.video_file || config.pcm_file) {
+        if (!capture_open(&emu->capture, config.video_file, config.video_format, config.pcm_file)) {
+            return false;
+        }
+
+        emu->capturing = true;
+    }
+
+    if (!emu->headless && !audio_init(&emu->audio, config.audio_samples)) {
         fprintf(stderr, "ERROR: Could not initialize audio\n");
         return false;
     }
 
+    emu->use_jit = config.use_jit;
+
+    if (emu->use_jit && !jit_init(&emu->jit)) {
+        fprintf(stderr, "WARNING: JIT unavailable, falling back to the interpreter\n");
+        emu->use_jit = false;
+    }
+
+    if (!emu->headless) {
+        emu->use_rewind = rewind_init(&emu->rewind);
+    }
+
+#ifdef DEBUG
+    if (trace_init(&emu->trace)) {
+        emu->trace.trigger = config.trace_trigger ? config.trace_trigger : TRACE_NO_TRIGGER;
+        emu->chip8.trace = &emu->trace;
+    }
+#endif
+
     // Set emulator variables
     emu->state = STATE_RUNNING;
-    emu->rom_file = rom_file;
+
+    if (!emu->headless) {
+        emu_resync_clock(emu);
+    }
 
     return true;
 }
 
-void emu_cleanup(const Emulator emu)
+void emu_cleanup(const Emulator* emu)
 {
-    SDL_DestroyRenderer(emu.renderer);
-    SDL_DestroyWindow(emu.window);
-    audio_cleanup(emu.audio);
+    chip8_cleanup(&emu->chip8);
+
+    if (emu->record_file) {
+        movie_cleanup(&emu->movie);
+    }
+
+    if (emu->use_jit) {
+        jit_cleanup(&emu->jit);
+    }
+
+    if (emu->use_rewind) {
+        rewind_cleanup(&emu->rewind);
+    }
+
+#ifdef DEBUG
+    trace_cleanup(&emu->trace);
+#endif
+
+    if (emu->headless) {
+        return;
+    }
+
+    input_report(&emu->input);
+
+    SDL_DestroySemaphore(emu->wake);
+    SDL_DestroyTexture(emu->grid);
+    SDL_DestroyTexture(emu->screen);
+    SDL_DestroyRenderer(emu->renderer);
+    SDL_DestroyWindow(emu->window);
+    audio_cleanup(&emu->audio);
+
     SDL_Quit();
 }
 
-void emu_clear_screen(const Emulator emu)
+void emu_publish_frame(Emulator* emu)
 {
-    const uint8_t r = (BACKGROUND_COLOR >> 24) & 0xFF;
-    const uint8_t g = (BACKGROUND_COLOR >> 16) & 0xFF;
-    const uint8_t b = (BACKGROUND_COLOR >>  8) & 0xFF;
-    const uint8_t a = (BACKGROUND_COLOR >>  0) & 0xFF;
+    // Emulation thread, hand the display to the render thread if it
+    //  changed since the last frame published
+    const Chip8* chip8 = &emu->chip8;
+
+    if (emu->published_hires == chip8->hires &&
+        memcmp(emu->published_palette, emu->palette, sizeof(emu->palette)) == 0 &&
+        memcmp(emu->published, chip8->display, sizeof(emu->published)) == 0) {
+        return;
+    }
+
+    memcpy(emu->published, chip8->display, sizeof(emu->published));
+    memcpy(emu->published_palette, emu->palette, sizeof(emu->palette));
+    emu->published_hires = chip8->hires;
+
+    Frame* frame = frame_buffer_back(&emu->frames);
+    memcpy(frame->display, emu->published, sizeof(frame->display));
+    memcpy(frame->palette, emu->palette, sizeof(frame->palette));
+    frame->hires = chip8->hires;
+    frame->press_count = input_take_presses(&emu->input, frame->presses);
+
+    const Frame* dropped = frame_buffer_publish(&emu->frames);
 
-    SDL_SetRenderDrawColor(emu.renderer, r, g, b, a);
-    SDL_RenderClear(emu.renderer);
+    if (dropped) {
+        // Replaced before it was presented, its presses show with the next frame
+        input_keep_presses(&emu->input, dropped->presses, dropped->press_count);
+    }
+
+    // Wake the render thread, one event at a time is enough
+    if (emu->frame_event && !atomic_exchange(&emu->frame_posted, true)) {
+        SDL_Event event = { .type = emu->frame_event };
+        SDL_PushEvent(&event);
+    }
 }
 
-void emu_update_screen(const Emulator emu)
+bool emu_update_screen(Emulator* emu)
 {
-    // TODO: Make specific functions to contain SDL graphics
-    SDL_Rect rect = { .x = 0, .y = 0, .w = WINDOW_SCALE, .h = WINDOW_SCALE };
+    // Render thread, present the newest published frame. Nothing to upload
+    //  or present when none was published and the window kept its contents
+    const bool fresh = frame_buffer_acquire(&emu->frames);
 
-    const uint8_t fg_r = (FOREGROUND_COLOR >> 24) & 0xFF;
-    const uint8_t fg_g = (FOREGROUND_COLOR >> 16) & 0xFF;
-    const uint8_t fg_b = (FOREGROUND_COLOR >>  8) & 0xFF;
-    const uint8_t fg_a = (FOREGROUND_COLOR >>  0) & 0xFF;
+    if (!fresh && !emu->redraw) {
+        return false;
+    }
 
-    const uint8_t bg_r = (BACKGROUND_COLOR >> 24) & 0xFF;
-    const uint8_t bg_g = (BACKGROUND_COLOR >> 16) & 0xFF;
-    const uint8_t bg_b = (BACKGROUND_COLOR >>  8) & 0xFF;
-    const uint8_t bg_a = (BACKGROUND_COLOR >>  0) & 0xFF;
+    const Frame* frame = frame_buffer_front(&emu->frames);
+    const uint32_t* palette = frame->palette;
 
-    // Loop through display pixels and draw a rectangle per pixel
-    for (uint32_t i = 0; i < sizeof(emu.chip8.display); ++i) {
-        // Translate 1D index to 2D X / Y coordinates
-        rect.x = (i % WINDOW_WIDTH) * WINDOW_SCALE;
-        rect.y = (i / WINDOW_WIDTH) * WINDOW_SCALE;
+    if (palette[0] != emu->grid_color) {
+        emu_update_grid(emu, palette[0]);
+    }
 
-        if (emu.chip8.display[i]) {
-            // If pixel is on, draw foreground color
-            SDL_SetRenderDrawColor(emu.renderer, fg_r, fg_g, fg_b, fg_a);
-            SDL_RenderFillRect(emu.renderer, &rect);
+    emu->redraw = false;
 
-            // Draw pixel outlines
-            SDL_SetRenderDrawColor(emu.renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderDrawRect(emu.renderer, &rect);
-        } else {
-            // If pixel is off, draw background color
-            SDL_SetRenderDrawColor(emu.renderer, bg_r, bg_g, bg_b, bg_a);
-            SDL_RenderFillRect(emu.renderer, &rect);
+    const SDL_Rect source = {
+        0, 0,
+        frame->hires ? HIRES_WIDTH : WINDOW_WIDTH,
+        frame->hires ? HIRES_HEIGHT : WINDOW_HEIGHT
+    };
+
+    void* pixels;
+    int pitch;
+
+    if (SDL_LockTexture(emu->screen, NULL, &pixels, &pitch) != 0) {
+        return false;
+    }
+
+    // Expand the packed rows of both planes into one texel per pixel, only
+    //  the top left of the texture is used in lo-res
+    for (int y = 0; y < source.h; ++y) {
+        uint32_t* texels = (uint32_t*)((uint8_t*)pixels + y * pitch);
+
+        for (int word = 0; word < source.w / 64; ++word) {
+            const uint64_t plane1 = frame->display[0][y][word];
+            const uint64_t plane2 = frame->display[1][y][word];
+
+            for (int bit = 63; bit >= 0; --bit) {
+                *texels++ = palette[((plane1 >> bit) & 1) | (((plane2 >> bit) & 1) << 1)];
+            }
         }
     }
 
-    SDL_RenderPresent(emu.renderer);
+    SDL_UnlockTexture(emu->screen);
+
+    // Scale the display to the window and draw the pixel outlines over it
+    SDL_RenderClear(emu->renderer);
+    SDL_RenderCopy(emu->renderer, emu->screen, &source, NULL);
+
+    if (!frame->hires) {
+        SDL_RenderCopy(emu->renderer, emu->grid, NULL, NULL);
+    }
+
+    SDL_RenderPresent(emu->renderer);
+
+    // Every published frame differs from the one before, the first one
+    //  after a key press ends its latency
+    if (fresh) {
+        input_presented(&emu->input, frame->presses, frame->press_count, SDL_GetPerformanceCounter());
+    }
+
+    return true;
 }
 
-void emu_handle_events(Emulator* emu)
+static void emu_close(Emulator* emu)
 {
-    SDL_Event event;
+    emu->quit = true;
+    emu_post_command(emu, COMMAND_QUIT);
+}
 
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-        case SDL_QUIT:
-            emu->state = STATE_QUIT;
+static void emu_handle_event(Emulator* emu, const SDL_Event* event, uint64_t counter)
+{
+    // Render thread, everything touching the machine goes to the
+    //  emulation thread as a command or a queued key
+    if (event->type == emu->frame_event) {
+        // Presented after the queue is drained
+        atomic_store(&emu->frame_posted, false);
+        return;
+    }
+
+    if (event->type == emu->frame_event + 1) {
+        SDL_SetWindowTitle(emu->window, event->user.data1);
+        free(event->user.data1);
+        return;
+    }
+
+    switch (event->type) {
+    case SDL_QUIT:
+        emu_close(emu);
+        break;
+
+    case SDL_WINDOWEVENT:
+        // The window contents were lost, present again on the next update
+        if (event->window.event == SDL_WINDOWEVENT_EXPOSED ||
+            event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            emu->redraw = true;
+        }
+        break;
+
+    case SDL_KEYDOWN:
+        switch (event->key.keysym.sym) {
+        case SDLK_ESCAPE:
+            emu_close(emu);
             break;
 
-        case SDL_KEYDOWN:
-            switch (event.key.keysym.sym) {
-            case SDLK_ESCAPE:
-                // Set emulator state to STATE_QUIT
-                emu->state = STATE_QUIT;
-                break;
-
-            case SDLK_SPACE:
-                // Switch emulator state between STATE_RUNNING and STATE_PAUSED
-                if (emu->state == STATE_RUNNING) {
-                    emu->state = STATE_PAUSED;
-                    puts("INFO: Emulator paused");
-                } else {
-                    emu->state = STATE_RUNNING;
-                    puts("INFO: Emulator resumed");
-                }
-                break;
-
-            case SDLK_RETURN:
-                // Reset CHIP-8
-                chip8_init(&emu->chip8, emu->rom_file);
-                break;
-            
-            // CHIP-8 Keypad | QWERTY Keyboard
-            // 123C          | 1234
-            // 456D          | QWER
-            // 789E          | ASDF
-            // A0BF          | ZXCV
-            case SDLK_1: emu->chip8.keypad[0x1] = true; break;
-            case SDLK_2: emu->chip8.keypad[0x2] = true; break;
-            case SDLK_3: emu->chip8.keypad[0x3] = true; break;
-            case SDLK_4: emu->chip8.keypad[0xC] = true; break;
-
-            case SDLK_q: emu->chip8.keypad[0x4] = true; break;
-            case SDLK_w: emu->chip8.keypad[0x5] = true; break;
-            case SDLK_e: emu->chip8.keypad[0x6] = true; break;
-            case SDLK_r: emu->chip8.keypad[0xD] = true; break;
-
-            case SDLK_a: emu->chip8.keypad[0x7] = true; break;
-            case SDLK_s: emu->chip8.keypad[0x8] = true; break;
-            case SDLK_d: emu->chip8.keypad[0x9] = true; break;
-            case SDLK_f: emu->chip8.keypad[0xE] = true; break;
-
-            case SDLK_z: emu->chip8.keypad[0xA] = true; break;
-            case SDLK_x: emu->chip8.keypad[0x0] = true; break;
-            case SDLK_c: emu->chip8.keypad[0xB] = true; break;
-            case SDLK_v: emu->chip8.keypad[0xF] = true; break;
-
-            default:
-                break;
-            }
+        case SDLK_SPACE:
+            // Switch emulator state between STATE_RUNNING and STATE_PAUSED
+            emu_post_command(emu, COMMAND_PAUSE);
+            break;
+
+        case SDLK_TAB:
+            emu_post_command(emu, COMMAND_TURBO);
             break;
 
-        case SDL_KEYUP:
-            switch (event.key.keysym.sym) {
-            case SDLK_1: emu->chip8.keypad[0x1] = false; break;
-            case SDLK_2: emu->chip8.keypad[0x2] = false; break;
-            case SDLK_3: emu->chip8.keypad[0x3] = false; break;
-            case SDLK_4: emu->chip8.keypad[0xC] = false; break;
-
-            case SDLK_q: emu->chip8.keypad[0x4] = false; break;
-            case SDLK_w: emu->chip8.keypad[0x5] = false; break;
-            case SDLK_e: emu->chip8.keypad[0x6] = false; break;
-            case SDLK_r: emu->chip8.keypad[0xD] = false; break;
-
-            case SDLK_a: emu->chip8.keypad[0x7] = false; break;
-            case SDLK_s: emu->chip8.keypad[0x8] = false; break;
-            case SDLK_d: emu->chip8.keypad[0x9] = false; break;
-            case SDLK_f: emu->chip8.keypad[0xE] = false; break;
-
-            case SDLK_z: emu->chip8.keypad[0xA] = false; break;
-            case SDLK_x: emu->chip8.keypad[0x0] = false; break;
-            case SDLK_c: emu->chip8.keypad[0xB] = false; break;
-            case SDLK_v: emu->chip8.keypad[0xF] = false; break;
-
-            default:
-                break;
+        case SDLK_RETURN:
+            emu_post_command(emu, COMMAND_RESET);
+            break;
+
+        case SDLK_F5:
+            emu_post_command(emu, COMMAND_SAVE_STATE);
+            break;
+
+        case SDLK_BACKSPACE:
+            // Step back through recorded frames while held
+            if (!event->key.repeat) {
+                emu_post_command(emu, COMMAND_REWIND_START);
             }
+            break;
+
+        case SDLK_F9:
+            emu_post_command(emu, COMMAND_LOAD_STATE);
+            break;
+
+        case SDLK_PAGEDOWN:
+            // Next or previous ROM of the library
+            emu_post_command(emu, COMMAND_NEXT_ROM);
+            break;
+
+        case SDLK_PAGEUP:
+            emu_post_command(emu, COMMAND_PREVIOUS_ROM);
+            break;
+
+#ifdef DEBUG
+        case SDLK_F2:
+            emu_post_command(emu, COMMAND_DUMP_TRACE);
+            break;
+#endif
+
+        // CHIP-8 Keypad | QWERTY Keyboard
+        // 123C          | 1234
+        // 456D          | QWER
+        // 789E          | ASDF
+        // A0BF          | ZXCV
+        case SDLK_1: emu_queue_key(emu, event, counter, 0x1, true); break;
+        case SDLK_2: emu_queue_key(emu, event, counter, 0x2, true); break;
+        case SDLK_3: emu_queue_key(emu, event, counter, 0x3, true); break;
+        case SDLK_4: emu_queue_key(emu, event, counter, 0xC, true); break;
+
+        case SDLK_q: emu_queue_key(emu, event, counter, 0x4, true); break;
+        case SDLK_w: emu_queue_key(emu, event, counter, 0x5, true); break;
+        case SDLK_e: emu_queue_key(emu, event, counter, 0x6, true); break;
+        case SDLK_r: emu_queue_key(emu, event, counter, 0xD, true); break;
+
+        case SDLK_a: emu_queue_key(emu, event, counter, 0x7, true); break;
+        case SDLK_s: emu_queue_key(emu, event, counter, 0x8, true); break;
+        case SDLK_d: emu_queue_key(emu, event, counter, 0x9, true); break;
+        case SDLK_f: emu_queue_key(emu, event, counter, 0xE, true); break;
+
+        case SDLK_z: emu_queue_key(emu, event, counter, 0xA, true); break;
+        case SDLK_x: emu_queue_key(emu, event, counter, 0x0, true); break;
+        case SDLK_c: emu_queue_key(emu, event, counter, 0xB, true); break;
+        case SDLK_v: emu_queue_key(emu, event, counter, 0xF, true); break;
+
+        default:
+            break;
+        }
+        break;
 
+    case SDL_KEYUP:
+        switch (event->key.keysym.sym) {
+        case SDLK_BACKSPACE:
+            emu_post_command(emu, COMMAND_REWIND_STOP);
             break;
 
+        case SDLK_1: emu_queue_key(emu, event, counter, 0x1, false); break;
+        case SDLK_2: emu_queue_key(emu, event, counter, 0x2, false); break;
+        case SDLK_3: emu_queue_key(emu, event, counter, 0x3, false); break;
+        case SDLK_4: emu_queue_key(emu, event, counter, 0xC, false); break;
+
+        case SDLK_q: emu_queue_key(emu, event, counter, 0x4, false); break;
+        case SDLK_w: emu_queue_key(emu, event, counter, 0x5, false); break;
+        case SDLK_e: emu_queue_key(emu, event, counter, 0x6, false); break;
+        case SDLK_r: emu_queue_key(emu, event, counter, 0xD, false); break;
+
+        case SDLK_a: emu_queue_key(emu, event, counter, 0x7, false); break;
+        case SDLK_s: emu_queue_key(emu, event, counter, 0x8, false); break;
+        case SDLK_d: emu_queue_key(emu, event, counter, 0x9, false); break;
+        case SDLK_f: emu_queue_key(emu, event, counter, 0xE, false); break;
+
+        case SDLK_z: emu_queue_key(emu, event, counter, 0xA, false); break;
+        case SDLK_x: emu_queue_key(emu, event, counter, 0x0, false); break;
+        case SDLK_c: emu_queue_key(emu, event, counter, 0xB, false); break;
+        case SDLK_v: emu_queue_key(emu, event, counter, 0xF, false); break;
+
         default:
             break;
         }
+
+        break;
+
+    default:
+        break;
     }
 }
 
-void emu_update_timers(Emulator* emu)
+void emu_wait_events(Emulator* emu)
 {
-    Chip8* chip8 = &emu->chip8;
+    // Sleep until the next event, input or a published frame, instead of
+    //  polling, then drain the queue. Events are stamped when taken off
+    //  the queue, SDL's own stamps only count milliseconds
+    SDL_Event event;
 
-    if (chip8->delay_timer > 0) {
-        chip8->delay_timer--;
+    if (SDL_WaitEvent(&event)) {
+        emu_handle_event(emu, &event, SDL_GetPerformanceCounter());
     }
 
-    if (chip8->sound_timer > 0) {
-        chip8->sound_timer--;
-        SDL_PauseAudioDevice(emu->audio.device, 0); // Play sound
-    } else {
-        SDL_PauseAudioDevice(emu->audio.device, 1); // Pause sound
+    while (SDL_PollEvent(&event)) {
+        emu_handle_event(emu, &event, SDL_GetPerformanceCounter());
+    }
+}
+
+void emu_post_command(Emulator* emu, EmuCommand command)
+{
+    // Render thread, dropped when the emulation thread is this far behind
+    const uint32_t tail = atomic_load_explicit(&emu->command_tail, memory_order_acquire);
+    const uint32_t head = atomic_load_explicit(&emu->command_head, memory_order_relaxed);
+
+    if (head - tail == EMU_COMMAND_QUEUE_SIZE) {
+        return;
+    }
+
+    emu->commands[head & (EMU_COMMAND_QUEUE_SIZE - 1)] = command;
+    atomic_store_explicit(&emu->command_head, head + 1, memory_order_release);
+    SDL_SemPost(emu->wake);
+}
+
+static void emu_run_command(Emulator* emu, EmuCommand command)
+{
+    switch (command) {
+    case COMMAND_QUIT:
+        emu->state = STATE_QUIT;
+        break;
+
+    case COMMAND_PAUSE:
+        if (emu->state == STATE_RUNNING) {
+            emu->state = STATE_PAUSED;
+            puts("INFO: Emulator paused");
+        } else {
+            emu->state = STATE_RUNNING;
+            emu_resync_clock(emu);
+            puts("INFO: Emulator resumed");
+        }
+        break;
+
+    case COMMAND_TURBO:
+        // Toggle turbo, the timers keep following emulated time
+        emu->turbo = !emu->turbo;
+        emu_resync_clock(emu);
+        puts(emu->turbo ? "INFO: Turbo on" : "INFO: Turbo off");
+        break;
+
+    case COMMAND_RESET:
+        // Reset CHIP-8 to the state right after loading
+        emu_restore(emu, emu->pristine, sizeof(emu->pristine));
+        break;
+
+    case COMMAND_SAVE_STATE:
+        emu_quick_save(emu);
+        break;
+
+    case COMMAND_LOAD_STATE:
+        emu_quick_load(emu);
+        break;
+
+    case COMMAND_REWIND_START:
+        emu->rewinding = emu->use_rewind;
+        break;
+
+    case COMMAND_REWIND_STOP:
+        if (emu->rewinding) {
+            emu->rewinding = false;
+            emu_resync_clock(emu);
+        }
+        break;
+
+    case COMMAND_NEXT_ROM:
+        emu_switch_rom(emu, 1);
+        break;
+
+    case COMMAND_PREVIOUS_ROM:
+        emu_switch_rom(emu, -1);
+        break;
+
+    case COMMAND_DUMP_TRACE:
+#ifdef DEBUG
+        emu_dump_trace(emu);
+#endif
+        break;
+    }
+}
+
+void emu_run_commands(Emulator* emu)
+{
+    // Emulation thread, carry out the commands in the order they were sent
+    const uint32_t head = atomic_load_explicit(&emu->command_head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&emu->command_tail, memory_order_relaxed);
+
+    for (; tail != head && emu->state != STATE_QUIT; ++tail) {
+        emu_run_command(emu, emu->commands[tail & (EMU_COMMAND_QUEUE_SIZE - 1)]);
+        atomic_store_explicit(&emu->command_tail, tail + 1, memory_order_release);
+    }
+}
+
+void emu_update_audio(Emulator* emu, bool tone)
+{
+    // Queue the emulated time since the last call as samples. The tone
+    //  can only change where a slice ends, on a timer tick or after an
+    //  FX18, so the whole slice plays as it started and the edge lands on
+    //  the sample of its instruction. Turbo runs ahead of real time and is
+    //  not queued
+    const uint64_t due = emu->instructions * emu->audio.have.freq / emu->chip8.ips;
+
+    if (!emu->turbo) {
+        audio_push(&emu->audio, due - emu->audio_samples, tone);
+    }
+
+    emu->audio_samples = due;
+}
+
+uint32_t emu_execute(Emulator* emu, uint32_t count)
+{
+    // Returns the instructions executed, fewer than count after an FX18
+    //  that turned the tone on or off
+    uint32_t executed = 0;
+
+#ifdef CHIP8_AOT
+    if (emu->use_aot) {
+        bool code_modified = false;
+        executed = chip8_aot_run(&emu->chip8, count, &code_modified);
+
+        if (code_modified) {
+            // Translated code no longer matches RAM
+            emu->use_aot = false;
+            puts("INFO: ROM modified its own code, switching to the interpreter");
+        } else {
+            return executed;
+        }
+    }
+#endif
+
+    if (emu->use_jit) {
+        return executed + jit_run(&emu->jit, &emu->chip8, count - executed);
+    }
+
+    return executed + chip8_step(&emu->chip8, count - executed);
+}
+
+uint64_t emu_advance(Emulator* emu, uint64_t count)
+{
+    // Run count instructions in slices that end on timer ticks and on
+    //  FX18s switching the tone, returns the number of timer ticks
+    uint64_t ticks = 0;
+
+    while (count > 0) {
+        uint32_t slice = chip8_instructions_to_tick(&emu->chip8);
+        if (slice > count) {
+            slice = count;
+        }
+
+        // The tone the slice plays, it changes after its last instruction
+        const bool tone = emu->chip8.sound_timer > 0;
+
+        PROFILE_BEGIN(PROFILE_EXECUTE);
+        slice = emu_execute(emu, slice);
+        PROFILE_END(&emu->chip8, PROFILE_EXECUTE);
+
+        emu->executed += slice;
+        emu->instructions += slice;
+        count -= slice;
+
+#ifdef DEBUG
+        if (emu->trace.triggered) {
+            // Once, the slice that hit the trigger PC is included
+            emu->trace.triggered = false;
+            emu->trace.trigger = TRACE_NO_TRIGGER;
+            emu_dump_trace(emu);
+        }
+#endif
+
+        if (!emu->headless) {
+            emu_update_audio(emu, tone);
+        }
+
+        if (emu->capturing) {
+            capture_audio(&emu->capture, slice, emu->chip8.ips, tone);
+        }
+
+        if (chip8_advance_clock(&emu->chip8, slice)) {
+            PROFILE_BEGIN(PROFILE_TIMERS);
+
+            chip8_tick_timers(&emu->chip8);
+
+            if (emu->use_rewind) {
+                rewind_push(&emu->rewind, &emu->chip8);
+            }
+
+            // One captured frame per 60 Hz tick of emulated time
+            if (emu->capturing) {
+                capture_frame(&emu->capture, &emu->chip8, emu->palette);
+            }
+
+            PROFILE_END(&emu->chip8, PROFILE_TIMERS);
+
+            ticks++;
+        }
+    }
+
+    return ticks;
+}
+
+void emu_schedule(Emulator* emu)
+{
+    // Owe instructions for the real time elapsed since the last call,
+    //  measured with the high resolution counter so nothing drifts
+    const uint64_t start = emu->last_counter;
+    const uint64_t now = SDL_GetPerformanceCounter();
+    double elapsed = (double)(now - start) / SDL_GetPerformanceFrequency();
+    emu->last_counter = now;
+
+    // Do not try to make up long stalls (window drags, debugger)
+    if (elapsed > EMU_MAX_CATCH_UP) {
+        elapsed = EMU_MAX_CATCH_UP;
+    }
+
+    emu->inst_budget += elapsed * emu->chip8.ips;
+
+    const uint64_t count = (uint64_t)emu->inst_budget;
+    emu->inst_budget -= count;
+
+    // The instructions cover the real time from start to now, a queued
+    //  key event lands on the instruction at the same point of that span
+    //  instead of on the frame boundary
+    const uint64_t first = emu->instructions;
+    InputEvent event;
+
+    while (input_pop(&emu->input, &event)) {
+        uint64_t target = first;
+
+        if (event.counter > start && now > start) {
+            target += (uint64_t)((double)(event.counter - start) / (now - start) * count);
+        }
+
+        if (target > first + count) {
+            target = first + count;
+        }
+
+        if (target > emu->instructions) {
+            emu_advance(emu, target - emu->instructions);
+        }
+
+        emu_apply_key(emu, &event);
     }
+
+    emu_advance(emu, first + count - emu->instructions);
+}
+
+void emu_wait_frame(Emulator* emu)
+{
+    // Sleep until the next frame deadline, deadlines advance by a fixed
+    //  period so a late frame does not push back the following ones
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t period = frequency / FPS;
+    const uint64_t now = SDL_GetPerformanceCounter();
+
+    emu->next_frame += period;
+
+    if (emu->next_frame <= now) {
+        // More than a frame behind, start over from now
+        emu->next_frame = now;
+        return;
+    }
+
+    SDL_Delay((uint32_t)((emu->next_frame - now) * 1000 / frequency));
+}
+
+void emu_run_turbo(Emulator* emu)
+{
+    // Run uncapped for one frame period of real time, then let the
+    //  caller present, so rendering stays at FPS however fast the core is
+    const uint64_t deadline = SDL_GetPerformanceCounter() + SDL_GetPerformanceFrequency() / FPS;
+
+    emu_flush_input(emu);
+
+    do {
+        emu_advance(emu, EMU_TURBO_SLICE);
+    } while (!emu_blocked(emu) && SDL_GetPerformanceCounter() < deadline);
 }
 
+bool emu_blocked(const Emulator* emu)
+{
+    // Waiting for a key or halted with both timers stopped, nothing can
+    //  change before the next event
+    const Chip8* chip8 = &emu->chip8;
+
+    return (chip8->idle == CHIP8_WAIT_KEY || chip8->idle == CHIP8_HALTED) &&
+        chip8->delay_timer == 0 && chip8->sound_timer == 0 && !emu->rewinding;
+}
+
+void emu_sleep(Emulator* emu)
+{
+    // Emulation thread, block until the next key or command. The time
+    //  spent blocked is not owed, so keys pressed meanwhile apply right away
+    SDL_SemWait(emu->wake);
+    emu_flush_input(emu);
+    emu_resync_clock(emu);
+}
+
+void emu_report_speed(Emulator* emu)
+{
+    // Once a second, show the achieved instructions per second and the
+    //  multiple of the ROM's clock rate in the window title. The window
+    //  belongs to the render thread, the title is sent to it as an event
+    const uint64_t now = SDL_GetPerformanceCounter();
+    const double elapsed = (double)(now - emu->report_counter) / SDL_GetPerformanceFrequency();
+
+    if (elapsed < 1.0) {
+        return;
+    }
+
+    const double ips = emu->executed / elapsed;
+    const double speed = ips / emu->chip8.ips;
+
+    char* title = malloc(128);
+    snprintf(title, 128, "%s - %.0f IPS (%.2fx)%s",
+        WINDOW_TITLE, ips, speed, emu->turbo ? " turbo" : "");
+
+    SDL_Event event = { .type = emu->frame_event + 1 };
+    event.user.data1 = title;
+
+    if (SDL_PushEvent(&event) != 1) {
+        free(title);
+    }
+
+    if (emu->turbo) {
+        printf("INFO: %.0f IPS (%.2fx)\n", ips, speed);
+    }
+
+    emu->report_counter = now;
+    emu->executed = 0;
+}
+
+void emu_rewind(Emulator* emu)
+{
+    // One recorded frame back per call, stops at the oldest frame
+    emu_flush_input(emu);
+
+    const uint8_t* state = rewind_seek(&emu->rewind, 1);
+
+    if (state) {
+        emu_restore(emu, state, CHIP8_STATE_SIZE);
+    }
+}
+
+void emu_set_key(Emulator* emu, uint8_t key, bool pressed)
+{
+    // Only transitions are recorded, key repeat changes nothing
+    if (emu->chip8.keypad[key] == pressed) {
+        return;
+    }
+
+    chip8_set_key(&emu->chip8, key, pressed);
+
+    if (emu->record_file) {
+        movie_record(&emu->movie, emu->instructions, key, pressed);
+    }
+}
+
+void emu_stop_recording(Emulator* emu)
+{
+    if (!emu->record_file) {
+        return;
+    }
+
+    movie_finish(&emu->movie, &emu->chip8, emu->instructions);
+
+    if (movie_save(&emu->movie, emu->record_file)) {
+        printf("INFO: Recorded %zu key events over %llu instructions to \"%s\"\n",
+            emu->movie.count, (unsigned long long)emu->instructions, emu->record_file);
+    }
+
+    movie_cleanup(&emu->movie);
+    emu->record_file = NULL;
+}
+
+bool emu_stop_capture(Emulator* emu)
+{
+    // Writes out what is still buffered, false if any write failed
+    if (!emu->capturing) {
+        return true;
+    }
+
+    emu->capturing = false;
+
+    return capture_close(&emu->capture);
+}
+
+bool emu_replay(Emulator* emu, const Movie* movie)
+{
+    // Feed the recorded input at the recorded instruction indices, no
+    //  pacing, returns true if the run ends in the recorded state
+    for (size_t i = 0; i < movie->count; ++i) {
+        const MovieEvent* event = &movie->events[i];
+
+        if (event->instruction > movie->length) {
+            fprintf(stderr, "ERROR: Corrupt movie, event past its end\n");
+            return false;
+        }
+
+        emu_advance(emu, event->instruction - emu->instructions);
+        chip8_set_key(&emu->chip8, event->key, event->pressed);
+    }
+
+    emu_advance(emu, movie->length - emu->instructions);
+
+    return movie_state_hash(&emu->chip8) == movie->state_hash;
+}
+
+#ifdef DEBUG
+void emu_dump_trace(Emulator* emu)
+{
+    // Overwrites the previous dump, decode with chip8trace
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.trace", emu->rom_file);
+
+    if (!emu->chip8.trace || !trace_save(emu->chip8.trace, path)) {
+        return;
+    }
+
+    emu->trace_dumped = true;
+    printf("INFO: Wrote the last %llu instructions to \"%s\"\n",
+        (unsigned long long)(emu->trace.steps < TRACE_CAPACITY ? emu->trace.steps : TRACE_CAPACITY),
+        path);
+}
+#endif
@@ -3,13 +3,27 @@
 
 #include <SDL2/SDL.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include "chip.h"
 #include "audio.h"
+#include "jit.h"
+#include "rewind.h"
+#include "movie.h"
+#include "trace.h"
+#include "library.h"
+#include "romdb.h"
+#include "input.h"
+#include "frame.h"
+#include "capture.h"
 
 #define WINDOW_SCALE 15
+#define WINDOW_TITLE "CHIP-8 Emulator"
 
-#define FPS 60
+#define FPS 60               // Render rate when vsync is off or nothing was presented
+#define EMU_MAX_CATCH_UP 0.25 // Seconds of emulation made up for after a stall
+#define EMU_TURBO_SLICE 1024  // Instructions run between clock reads in turbo mode
+#define EMU_COMMAND_QUEUE_SIZE 16 // Commands between two emulation frames, a power of two
 
 typedef enum EmulatorState
 {
@@ -18,24 +32,148 @@ typedef enum EmulatorState
     STATE_QUIT
 } EmulatorState;
 
+// Sent by the render thread, carried out by the emulation thread
+typedef enum EmuCommand
+{
+    COMMAND_QUIT = 0,
+    COMMAND_PAUSE,         // Toggles
+    COMMAND_TURBO,         // Toggles
+    COMMAND_RESET,
+    COMMAND_SAVE_STATE,
+    COMMAND_LOAD_STATE,
+    COMMAND_REWIND_START,
+    COMMAND_REWIND_STOP,
+    COMMAND_NEXT_ROM,
+    COMMAND_PREVIOUS_ROM,
+    COMMAND_DUMP_TRACE
+} EmuCommand;
+
+typedef struct EmulatorConfig
+{
+    const Library* library; // ROMs to switch between, kept open for the session
+    uint32_t rom;           // Index of the ROM started first
+    const RomDb* db;        // Per-ROM platform, speed, quirks and colors
+    uint64_t seed;  // RNG seed, reused on reset so runs are reproducible
+    uint8_t quirks; // Quirk profile, see Quirk in chip.h
+    bool quirks_given; // Use quirks instead of the database's
+    uint16_t ips;   // Instructions per second, 0 for the database's
+    bool use_jit;   // Run compiled x86-64 blocks instead of the interpreter
+    bool headless;  // No window, audio or input, SDL is never initialized
+    bool vsync;     // Present in step with the display refresh
+    bool turbo;     // Start uncapped, toggled with Tab
+    const char* record_file; // Record keypad input into this movie file
+    uint16_t audio_samples;  // Audio device buffer in samples
+    const char* video_file;  // Write every frame raw into this file, "-" for stdout
+    CaptureFormat video_format;
+    const char* pcm_file;    // Write the sound as raw PCM into this file, "-" for stdout
+#ifdef DEBUG
+    uint32_t trace_trigger;  // Dump the trace when this PC executes, 0 for never
+#endif
+} EmulatorConfig;
+
 typedef struct Emulator
 {
+    // Render thread, the one SDL was initialized on: window, events and
+    //  presenting the newest frame
     SDL_Window* window;
     SDL_Renderer* renderer;
+    SDL_Texture* screen; // Display sized streaming texture scaled up on copy
+    SDL_Texture* grid;   // Window sized pixel outlines drawn over the screen
+    uint32_t grid_color; // Background color the outlines were drawn in
+    bool redraw;         // Present even if no new frame was published
+    bool vsync;          // Presents wait for the display refresh
+    bool quit;           // The window was closed, the emulation thread told to stop
+
+    // Between the threads
+    FrameBuffer frames;
+    SDL_sem* wake;             // Posted with every key event and command
+    uint32_t frame_event;      // SDL user event for a published frame, the next one for a title
+    atomic_bool frame_posted;  // A frame event is waiting in the SDL queue
+    uint8_t commands[EMU_COMMAND_QUEUE_SIZE]; // EmuCommand, single producer and consumer
+    atomic_uint command_head;
+    atomic_uint command_tail;
 
+    // Emulation thread from here on
+    uint32_t palette[4]; // Colors by plane bits, plane 1 is bit 0
+
+    // Display last published, a frame is only handed over when it changed
+    uint64_t published[DISPLAY_PLANES][HIRES_HEIGHT][DISPLAY_ROW_WORDS];
+    bool published_hires;
+    uint32_t published_palette[4];
+
+    // Scheduler, instructions are owed for real time and run in slices
+    //  that end on the 60 Hz timer ticks of emulated time
+    uint64_t last_counter; // Performance counter at the last schedule
+    uint64_t next_frame;   // Performance counter the next frame is due at
+    double inst_budget;    // Instructions owed, the fraction carries over
+    bool turbo;            // Run as fast as possible, present at FPS
+
+    uint64_t report_counter; // Performance counter at the last speed report
+    uint64_t executed;       // Instructions run since the last speed report
+    uint64_t instructions;   // Instructions run since loading, movie timestamps
+
+    Input input; // Keypad events waiting for their instruction, latency, shared
     Audio audio;
+    uint64_t audio_samples; // Emulated time queued as audio so far, in samples
     EmulatorState state;
     Chip8 chip8;
+    Jit jit;
+    Rewind rewind;
+    Movie movie;
+    const char* record_file; // Movie being recorded, NULL when not recording
+    Capture capture;
+    bool capturing; // Frames and sound are written out raw
+#ifdef DEBUG
+    Trace trace;
+    bool trace_dumped; // Written at least once this session
+#endif
+
+    // ROM running and what decides how ROMs are started
+    const Library* library;
+    uint32_t rom;
+    const char* rom_file; // Its name in the library, also names save states
+    const RomDb* db;
+    uint64_t seed;
+    uint8_t quirks;
+    bool quirks_given;
+    uint16_t ips;
 
-    const char* rom_file;
+    uint8_t pristine[CHIP8_STATE_SIZE];   // State after loading, restored on reset
+    uint8_t quick_save[CHIP8_STATE_SIZE]; // Saved with F5, loaded with F9
+    bool has_quick_save;
+    bool use_jit;
+    bool use_aot; // Run the ROM translated by chip8aot (CHIP8_AOT builds)
+    bool use_rewind; // Record every frame for rewinding
+    bool rewinding;  // Rewind key held, step back instead of emulating
+    bool headless;
 } Emulator;
 
-bool emu_init(Emulator* emu, const char* rom_file);
-void emu_cleanup(const Emulator emu);
-void emu_clear_screen(const Emulator emu);
-void emu_update_screen(const Emulator emu);
-void emu_handle_events(Emulator* emu);
-void emu_update_timers(Emulator* emu);
+bool emu_init(Emulator* emu, EmulatorConfig config);
+bool emu_init_textures(Emulator* emu);
+bool emu_load_rom(Emulator* emu, uint32_t index);
+void emu_cleanup(const Emulator* emu);
+bool emu_update_screen(Emulator* emu);
+void emu_publish_frame(Emulator* emu);
+void emu_wait_events(Emulator* emu);
+void emu_post_command(Emulator* emu, EmuCommand command);
+void emu_run_commands(Emulator* emu);
+void emu_update_audio(Emulator* emu, bool tone);
+uint32_t emu_execute(Emulator* emu, uint32_t count);
+uint64_t emu_advance(Emulator* emu, uint64_t count);
+void emu_schedule(Emulator* emu);
+void emu_wait_frame(Emulator* emu);
+void emu_run_turbo(Emulator* emu);
+bool emu_blocked(const Emulator* emu);
+void emu_sleep(Emulator* emu);
+void emu_report_speed(Emulator* emu);
+void emu_rewind(Emulator* emu);
+void emu_set_key(Emulator* emu, uint8_t key, bool pressed);
+void emu_stop_recording(Emulator* emu);
+bool emu_stop_capture(Emulator* emu);
+bool emu_replay(Emulator* emu, const Movie* movie);
+#ifdef DEBUG
+void emu_dump_trace(Emulator* emu);
+#endif
 
 #endif // _EMU_H_
 
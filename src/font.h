@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 extern const uint8_t g_font[80];
+extern const uint8_t g_big_font[160];
 
 #endif // _FONT_H_
 
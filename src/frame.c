@@ -0,0 +1,48 @@
+#include "frame.h"
+
+#include <string.h>
+
+void frame_buffer_init(FrameBuffer* buffer)
+{
+    memset(buffer->frames, 0, sizeof(buffer->frames));
+    buffer->back = 0;
+    buffer->front = 2;
+    atomic_init(&buffer->ready, 1);
+}
+
+Frame* frame_buffer_back(FrameBuffer* buffer)
+{
+    return &buffer->frames[buffer->back];
+}
+
+const Frame* frame_buffer_publish(FrameBuffer* buffer)
+{
+    // Writer side, hand over the back frame. Returns the frame published
+    //  before if the reader never took it, its contents were not shown
+    const uint32_t previous = atomic_exchange_explicit(&buffer->ready,
+        buffer->back | FRAME_FRESH, memory_order_acq_rel);
+
+    buffer->back = previous & ~FRAME_FRESH;
+
+    return previous & FRAME_FRESH ? &buffer->frames[buffer->back] : NULL;
+}
+
+bool frame_buffer_acquire(FrameBuffer* buffer)
+{
+    // Reader side, take the newest frame if one was published since
+    if (!(atomic_load_explicit(&buffer->ready, memory_order_relaxed) & FRAME_FRESH)) {
+        return false;
+    }
+
+    const uint32_t ready = atomic_exchange_explicit(&buffer->ready, buffer->front,
+        memory_order_acq_rel);
+
+    buffer->front = ready & ~FRAME_FRESH;
+
+    return true;
+}
+
+const Frame* frame_buffer_front(const FrameBuffer* buffer)
+{
+    return &buffer->frames[buffer->front];
+}
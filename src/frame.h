@@ -0,0 +1,43 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "chip.h"
+#include "input.h"
+
+#define FRAME_FRESH 4 // Flag in FrameBuffer.ready, set until the reader takes the frame
+
+// A finished display as published by the emulation thread
+typedef struct Frame
+{
+    uint64_t display[DISPLAY_PLANES][HIRES_HEIGHT][DISPLAY_ROW_WORDS];
+    bool hires;
+    uint32_t palette[4];
+
+    // Performance counters of the key presses this frame is the first to show
+    uint64_t presses[INPUT_PENDING_SIZE];
+    uint32_t press_count;
+} Frame;
+
+// Lock-free triple buffer, one writer and one reader. The writer fills
+//  the back frame and swaps it with the ready one, the reader swaps the
+//  ready one with its front frame. Neither ever waits for the other and
+//  the reader always gets the newest complete frame
+typedef struct FrameBuffer
+{
+    Frame frames[3];
+    uint32_t back;     // Writer only
+    uint32_t front;    // Reader only
+    atomic_uint ready; // Index of the frame in between, FRAME_FRESH if unread
+} FrameBuffer;
+
+void frame_buffer_init(FrameBuffer* buffer);
+Frame* frame_buffer_back(FrameBuffer* buffer);
+const Frame* frame_buffer_publish(FrameBuffer* buffer);
+bool frame_buffer_acquire(FrameBuffer* buffer);
+const Frame* frame_buffer_front(const FrameBuffer* buffer);
+
+#endif // _FRAME_H_
@@ -0,0 +1,122 @@
+#include "input.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void input_init(Input* input)
+{
+    memset(input, 0, sizeof(Input));
+    atomic_init(&input->head, 0);
+    atomic_init(&input->tail, 0);
+}
+
+bool input_push(Input* input, const InputEvent* event)
+{
+    // Producer side, false when the queue is full
+    const uint32_t tail = atomic_load_explicit(&input->tail, memory_order_acquire);
+    const uint32_t head = atomic_load_explicit(&input->head, memory_order_relaxed);
+
+    if (head - tail == INPUT_QUEUE_SIZE) {
+        return false;
+    }
+
+    input->queue[head & (INPUT_QUEUE_SIZE - 1)] = *event;
+    atomic_store_explicit(&input->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+bool input_pop(Input* input, InputEvent* event)
+{
+    // Consumer side, false when the queue is empty
+    const uint32_t head = atomic_load_explicit(&input->head, memory_order_acquire);
+    const uint32_t tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+
+    if (head == tail) {
+        return false;
+    }
+
+    *event = input->queue[tail & (INPUT_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&input->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+void input_applied(Input* input, const InputEvent* event)
+{
+    // Releases rarely change the display, only presses are measured
+    if (event->pressed) {
+        input_keep_presses(input, &event->counter, 1);
+    }
+}
+
+void input_keep_presses(Input* input, const uint64_t* presses, uint32_t count)
+{
+    // Presses beyond the limit are not measured
+    for (uint32_t i = 0; i < count && input->pending_count < INPUT_PENDING_SIZE; ++i) {
+        input->pending[input->pending_count++] = presses[i];
+    }
+}
+
+uint32_t input_take_presses(Input* input, uint64_t* presses)
+{
+    const uint32_t count = input->pending_count;
+
+    memcpy(presses, input->pending, count * sizeof(uint64_t));
+    input->pending_count = 0;
+
+    return count;
+}
+
+void input_presented(Input* input, const uint64_t* presses, uint32_t count, uint64_t counter)
+{
+    const double frequency = SDL_GetPerformanceFrequency();
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const double latency = counter > presses[i] ? (counter - presses[i]) / frequency : 0.0;
+        uint32_t bucket = latency * 1000;
+
+        if (bucket >= INPUT_LATENCY_BUCKETS) {
+            bucket = INPUT_LATENCY_BUCKETS - 1;
+        }
+
+        input->histogram[bucket]++;
+        input->latency_count++;
+        input->latency_sum += latency;
+
+        if (latency > input->latency_max) {
+            input->latency_max = latency;
+        }
+    }
+}
+
+static uint32_t input_percentile(const Input* input, double fraction)
+{
+    // Upper bound of the bucket the percentile falls into, in milliseconds
+    const uint64_t rank = (uint64_t)(input->latency_count * fraction);
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < INPUT_LATENCY_BUCKETS; ++i) {
+        seen += input->histogram[i];
+
+        if (seen > rank) {
+            return i + 1;
+        }
+    }
+
+    return INPUT_LATENCY_BUCKETS;
+}
+
+void input_report(const Input* input)
+{
+    if (input->latency_count == 0) {
+        return;
+    }
+
+    printf("INFO: Input to photon latency over %llu key presses: mean %.1f ms, "
+        "median < %u ms, 95th percentile < %u ms, max %.1f ms\n",
+        (unsigned long long)input->latency_count,
+        input->latency_sum / input->latency_count * 1000,
+        input_percentile(input, 0.5), input_percentile(input, 0.95),
+        input->latency_max * 1000);
+}
@@ -0,0 +1,51 @@
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define INPUT_QUEUE_SIZE 64       // Keypad events between two schedules, a power of two
+#define INPUT_PENDING_SIZE 16     // Presses waiting for the display to change
+#define INPUT_LATENCY_BUCKETS 250 // Milliseconds, the last one holds everything slower
+
+typedef struct InputEvent
+{
+    uint64_t counter; // Performance counter at the time of the event
+    uint8_t key;
+    bool pressed;
+} InputEvent;
+
+typedef struct Input
+{
+    // Keypad events in arrival order, applied by the scheduler at the
+    //  instruction matching their timestamps. Single producer, single
+    //  consumer, the render thread only stores head, the emulation thread
+    //  only stores tail
+    InputEvent queue[INPUT_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+
+    // Input to photon latency, from a key press to the first present of a
+    //  display that differs from the one before. Presses are collected on
+    //  the emulation thread and handed over with the frame showing them,
+    //  the statistics belong to the render thread
+    uint64_t pending[INPUT_PENDING_SIZE]; // Counters of applied presses
+    uint32_t pending_count;
+    uint32_t histogram[INPUT_LATENCY_BUCKETS];
+    uint64_t latency_count;
+    double latency_sum; // Seconds
+    double latency_max;
+} Input;
+
+void input_init(Input* input);
+bool input_push(Input* input, const InputEvent* event);
+bool input_pop(Input* input, InputEvent* event);
+void input_applied(Input* input, const InputEvent* event);
+void input_keep_presses(Input* input, const uint64_t* presses, uint32_t count);
+uint32_t input_take_presses(Input* input, uint64_t* presses);
+void input_presented(Input* input, const uint64_t* presses, uint32_t count, uint64_t counter);
+void input_report(const Input* input);
+
+#endif // _INPUT_H_
@@ -0,0 +1,564 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include "jit.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// The recompiler emits x86-64 code for the System V calling convention,
+//   other hosts always use the interpreter
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+// Worst case size of one compiled block in bytes
+#define JIT_MAX_BLOCK_SIZE (JIT_MAX_BLOCK_INSTRUCTIONS * 32 + 32)
+
+// Granularity of mprotect on x86-64
+#define JIT_PAGE_SIZE 4096
+
+// Registers used by the emitted code (Chip8* is kept in RDI)
+#define REG_AX 0
+#define REG_CX 1
+#define REG_DX 2
+
+// Chip8 field offsets addressed as [RDI + disp32]
+#define OFFSET_V(x) (offsetof(Chip8, V) + (x))
+#define OFFSET_I offsetof(Chip8, I)
+#define OFFSET_PC offsetof(Chip8, PC)
+#define OFFSET_STACK_PTR offsetof(Chip8, stack_ptr)
+#define OFFSET_DELAY_TIMER offsetof(Chip8, delay_timer)
+
+typedef enum JitEmitResult
+{
+    JIT_EMIT_NEXT = 0,   // Instruction compiled, block continues
+    JIT_EMIT_END,        // Instruction compiled and it sets PC itself
+    JIT_EMIT_UNSUPPORTED // Left to the interpreter, block ends before it
+} JitEmitResult;
+
+bool jit_init(Jit* jit)
+{
+    memset(jit, 0, sizeof(Jit));
+
+#ifdef JIT_SUPPORTED
+    // Never writable and executable at once, jit_compile switches it
+    void* buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buffer == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Could not allocate executable memory for the JIT\n");
+        return false;
+    }
+
+    jit->buffer = buffer;
+    return true;
+#else
+    fprintf(stderr, "ERROR: The JIT is only available on x86-64 POSIX hosts\n");
+    return false;
+#endif
+}
+
+void jit_cleanup(const Jit* jit)
+{
+#ifdef JIT_SUPPORTED
+    if (jit->buffer) {
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+    }
+#else
+    (void)jit;
+#endif
+}
+
+void jit_flush(Jit* jit)
+{
+    // Drop every compiled block, must be called whenever RAM is
+    //   replaced behind the JIT's back (e.g. on reset)
+    jit->used = 0;
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+}
+
+static bool jit_protect(Jit* jit, size_t offset, bool executable)
+{
+    // Only the pages a block emitted at offset can reach, switching the
+    //   whole buffer costs several times more
+#ifdef JIT_SUPPORTED
+    const size_t page_mask = JIT_PAGE_SIZE - 1;
+    const size_t start = offset & ~page_mask;
+    const size_t end = (offset + JIT_MAX_BLOCK_SIZE + page_mask) & ~page_mask;
+    const int protection = executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE;
+
+    return mprotect(jit->buffer + start, end - start, protection) == 0;
+#else
+    (void)jit;
+    (void)offset;
+    (void)executable;
+    return false;
+#endif
+}
+
+static void emit8(Jit* jit, uint8_t byte)
+{
+    jit->buffer[jit->used++] = byte;
+}
+
+static void emit16(Jit* jit, uint16_t value)
+{
+    emit8(jit, value & 0xFF);
+    emit8(jit, value >> 8);
+}
+
+static void emit32(Jit* jit, uint32_t value)
+{
+    emit16(jit, value & 0xFFFF);
+    emit16(jit, value >> 16);
+}
+
+static void emit_mem(Jit* jit, uint8_t reg, size_t offset)
+{
+    // ModRM for [RDI + disp32]
+    emit8(jit, 0x80 | (reg << 3) | 0x07);
+    emit32(jit, (uint32_t)offset);
+}
+
+static void emit_load8(Jit* jit, uint8_t reg, size_t offset)
+{
+    // mov r8, byte [rdi + offset]
+    emit8(jit, 0x8A);
+    emit_mem(jit, reg, offset);
+}
+
+static void emit_store8(Jit* jit, uint8_t reg, size_t offset)
+{
+    // mov byte [rdi + offset], r8
+    emit8(jit, 0x88);
+    emit_mem(jit, reg, offset);
+}
+
+static void emit_store16_imm(Jit* jit, size_t offset, uint16_t value)
+{
+    // mov word [rdi + offset], imm16
+    emit8(jit, 0x66);
+    emit8(jit, 0xC7);
+    emit_mem(jit, 0, offset);
+    emit16(jit, value);
+}
+
+static void emit_alu_al(Jit* jit, uint8_t opcode, size_t offset)
+{
+    // <op> al, byte [rdi + offset]
+    emit8(jit, opcode);
+    emit_mem(jit, REG_AX, offset);
+}
+
+static void emit_mov32_imm(Jit* jit, uint8_t reg, uint32_t value)
+{
+    // mov r32, imm32
+    emit8(jit, 0xB8 + reg);
+    emit32(jit, value);
+}
+
+static void emit_skip(Jit* jit, uint16_t pc, uint16_t next, uint8_t cmov)
+{
+    // Flags hold the comparison, PC becomes the next or the skipped-to
+    //  address. next is the following opcode, F000 NNNN is skipped whole
+    emit_mov32_imm(jit, REG_CX, (uint16_t)(pc + 2));
+    emit_mov32_imm(jit, REG_DX, (uint16_t)(pc + (next == 0xF000 ? 6 : 4)));
+
+    // cmovcc ecx, edx
+    emit8(jit, 0x0F);
+    emit8(jit, cmov);
+    emit8(jit, 0xCA);
+
+    // mov word [rdi + PC], cx
+    emit8(jit, 0x66);
+    emit8(jit, 0x89);
+    emit_mem(jit, REG_CX, OFFSET_PC);
+}
+
+static void emit_flag_result(Jit* jit, uint8_t x)
+{
+    // Store AL into VX and then CL into VF, in this order so VF wins when X is F
+    emit_store8(jit, REG_AX, OFFSET_V(x));
+    emit_store8(jit, REG_CX, OFFSET_V(0xF));
+}
+
+static JitEmitResult jit_emit_alu(Jit* jit, uint8_t quirks, uint8_t x, uint8_t y, uint8_t n)
+{
+    // Source register of the shifts
+    const uint8_t shift = (quirks & QUIRK_SHIFT_VY) ? y : x;
+
+    switch (n) {
+    case 0x0:
+        // 0x8XY0: Set VX to the value of VY
+        emit_load8(jit, REG_AX, OFFSET_V(y));
+        emit_store8(jit, REG_AX, OFFSET_V(x));
+        return JIT_EMIT_NEXT;
+
+    case 0x1:
+    case 0x2:
+    case 0x3:
+        // 0x8XY1 / 0x8XY2 / 0x8XY3: Bitwise or / and / xor
+        emit_load8(jit, REG_AX, OFFSET_V(x));
+        emit_alu_al(jit, n == 0x1 ? 0x0A : n == 0x2 ? 0x22 : 0x32, OFFSET_V(y));
+        emit_store8(jit, REG_AX, OFFSET_V(x));
+
+        if (quirks & QUIRK_VF_RESET) {
+            // mov byte [rdi + VF], 0
+            emit8(jit, 0xC6);
+            emit_mem(jit, 0, OFFSET_V(0xF));
+            emit8(jit, 0);
+        }
+        return JIT_EMIT_NEXT;
+
+    case 0x4:
+        // 0x8XY4: Add VY to VX, VF is the carry (setc cl)
+        emit_load8(jit, REG_AX, OFFSET_V(x));
+        emit_alu_al(jit, 0x02, OFFSET_V(y));
+        emit8(jit, 0x0F); emit8(jit, 0x92); emit8(jit, 0xC1);
+        emit_flag_result(jit, x);
+        return JIT_EMIT_NEXT;
+
+    case 0x5:
+        // 0x8XY5: VY is subtracted from VX, VF is not borrow (setnc cl)
+        emit_load8(jit, REG_AX, OFFSET_V(x));
+        emit_alu_al(jit, 0x2A, OFFSET_V(y));
+        emit8(jit, 0x0F); emit8(jit, 0x93); emit8(jit, 0xC1);
+        emit_flag_result(jit, x);
+        return JIT_EMIT_NEXT;
+
+    case 0x7:
+        // 0x8XY7: Set VX to VY minus VX, VF is not borrow (setnc cl)
+        emit_load8(jit, REG_AX, OFFSET_V(y));
+        emit_alu_al(jit, 0x2A, OFFSET_V(x));
+        emit8(jit, 0x0F); emit8(jit, 0x93); emit8(jit, 0xC1);
+        emit_flag_result(jit, x);
+        return JIT_EMIT_NEXT;
+
+    case 0x6:
+        // 0x8XY6: Shift right by 1 into VX, VF is the shifted out bit
+        emit_load8(jit, REG_AX, OFFSET_V(shift));
+        emit8(jit, 0x88); emit8(jit, 0xC1);             // mov cl, al
+        emit8(jit, 0x80); emit8(jit, 0xE1); emit8(jit, 0x01); // and cl, 1
+        emit8(jit, 0xD0); emit8(jit, 0xE8);             // shr al, 1
+        emit_flag_result(jit, x);
+        return JIT_EMIT_NEXT;
+
+    case 0xE:
+        // 0x8XYE: Shift left by 1 into VX, VF is the shifted out bit
+        emit_load8(jit, REG_AX, OFFSET_V(shift));
+        emit8(jit, 0x88); emit8(jit, 0xC1);             // mov cl, al
+        emit8(jit, 0xC0); emit8(jit, 0xE9); emit8(jit, 0x07); // shr cl, 7
+        emit8(jit, 0xD0); emit8(jit, 0xE0);             // shl al, 1
+        emit_flag_result(jit, x);
+        return JIT_EMIT_NEXT;
+
+    default:
+        // Not implemented or bad opcode, nothing to do
+        return JIT_EMIT_NEXT;
+    }
+}
+
+static JitEmitResult jit_emit(Jit* jit, uint8_t quirks, uint16_t opcode, uint16_t pc, uint16_t next)
+{
+    const uint16_t NNN = opcode & 0x0FFF;
+    const uint8_t NN = opcode & 0x0FF;
+    const uint8_t N = opcode & 0x0F;
+    const uint8_t X = (opcode >> 8) & 0x0F;
+    const uint8_t Y = (opcode >> 4) & 0x0F;
+
+    switch (opcode >> 12) {
+    case 0x00:
+        if (opcode == 0x00EE) {
+            // 0x00EE: Return from a subroutine
+            // mov rax, [rdi + stack_ptr]; sub rax, 2; mov [rdi + stack_ptr], rax
+            emit8(jit, 0x48); emit8(jit, 0x8B); emit_mem(jit, REG_AX, OFFSET_STACK_PTR);
+            emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xE8); emit8(jit, 0x02);
+            emit8(jit, 0x48); emit8(jit, 0x89); emit_mem(jit, REG_AX, OFFSET_STACK_PTR);
+
+            // movzx ecx, word [rax]; mov word [rdi + PC], cx
+            emit8(jit, 0x0F); emit8(jit, 0xB7); emit8(jit, 0x08);
+            emit8(jit, 0x66); emit8(jit, 0x89); emit_mem(jit, REG_CX, OFFSET_PC);
+            return JIT_EMIT_END;
+        }
+
+        // 00E0 and the SUPER-CHIP / XO-CHIP display opcodes
+        return JIT_EMIT_UNSUPPORTED;
+
+    case 0x01:
+        // 0x1NNN: Jump to address NNN
+        emit_store16_imm(jit, OFFSET_PC, NNN);
+        return JIT_EMIT_END;
+
+    case 0x02:
+        // 0x2NNN: Call subroutine at NNN
+        // mov rax, [rdi + stack_ptr]; mov word [rax], pc + 2; add qword [rdi + stack_ptr], 2
+        emit8(jit, 0x48); emit8(jit, 0x8B); emit_mem(jit, REG_AX, OFFSET_STACK_PTR);
+        emit8(jit, 0x66); emit8(jit, 0xC7); emit8(jit, 0x00); emit16(jit, pc + 2);
+        emit8(jit, 0x48); emit8(jit, 0x83); emit_mem(jit, 0, OFFSET_STACK_PTR); emit8(jit, 0x02);
+        emit_store16_imm(jit, OFFSET_PC, NNN);
+        return JIT_EMIT_END;
+
+    case 0x03:
+    case 0x04:
+        // 0x3XNN / 0x4XNN: Skip if VX equals / does not equal NN
+        // cmp byte [rdi + VX], NN
+        emit8(jit, 0x80);
+        emit_mem(jit, 7, OFFSET_V(X));
+        emit8(jit, NN);
+        emit_skip(jit, pc, next, (opcode >> 12) == 0x03 ? 0x44 : 0x45);
+        return JIT_EMIT_END;
+
+    case 0x05:
+    case 0x09:
+        if ((opcode >> 12) == 0x05 && (N == 0x2 || N == 0x3)) {
+            return JIT_EMIT_UNSUPPORTED; // 5XY2 / 5XY3 register ranges
+        }
+
+        // 0x5XY0 / 0x9XY0: Skip if VX equals / does not equal VY
+        emit_load8(jit, REG_AX, OFFSET_V(X));
+        emit_alu_al(jit, 0x3A, OFFSET_V(Y));
+        emit_skip(jit, pc, next, (opcode >> 12) == 0x05 ? 0x44 : 0x45);
+        return JIT_EMIT_END;
+
+    case 0x06:
+        // 0x6XNN: Set VX to NN (mov byte [rdi + VX], NN)
+        emit8(jit, 0xC6);
+        emit_mem(jit, 0, OFFSET_V(X));
+        emit8(jit, NN);
+        return JIT_EMIT_NEXT;
+
+    case 0x07:
+        // 0x7XNN: Adds NN to VX (add byte [rdi + VX], NN)
+        emit8(jit, 0x80);
+        emit_mem(jit, 0, OFFSET_V(X));
+        emit8(jit, NN);
+        return JIT_EMIT_NEXT;
+
+    case 0x08:
+        return jit_emit_alu(jit, quirks, X, Y, N);
+
+    case 0x0A:
+        // 0xANNN: Set I to the address NNN
+        emit_store16_imm(jit, OFFSET_I, NNN);
+        return JIT_EMIT_NEXT;
+
+    case 0x0B:
+        // 0xBNNN: Jump to the address NNN plus V0
+        // movzx eax, byte [rdi + V0]; add eax, NNN; mov word [rdi + PC], ax
+        emit8(jit, 0x0F); emit8(jit, 0xB6); emit_mem(jit, REG_AX, OFFSET_V(0));
+        emit8(jit, 0x05); emit32(jit, NNN);
+        emit8(jit, 0x66); emit8(jit, 0x89); emit_mem(jit, REG_AX, OFFSET_PC);
+        return JIT_EMIT_END;
+
+    case 0x0F:
+        switch (NN) {
+        case 0x07:
+            // 0xFX07: Set VX to the value of the delay timer
+            emit_load8(jit, REG_AX, OFFSET_DELAY_TIMER);
+            emit_store8(jit, REG_AX, OFFSET_V(X));
+            return JIT_EMIT_NEXT;
+
+        case 0x15:
+            // 0xFX15: Set the delay timer to VX
+            emit_load8(jit, REG_AX, OFFSET_V(X));
+            emit_store8(jit, REG_AX, OFFSET_DELAY_TIMER);
+            return JIT_EMIT_NEXT;
+
+        case 0x1E:
+            if (quirks & QUIRK_FX1E_OVERFLOW) {
+                return JIT_EMIT_UNSUPPORTED;
+            }
+
+            // 0xFX1E: Add VX to I
+            // movzx eax, byte [rdi + VX]; add word [rdi + I], ax
+            emit8(jit, 0x0F); emit8(jit, 0xB6); emit_mem(jit, REG_AX, OFFSET_V(X));
+            emit8(jit, 0x66); emit8(jit, 0x01); emit_mem(jit, REG_AX, OFFSET_I);
+            return JIT_EMIT_NEXT;
+
+        case 0x29:
+            // 0xFX29: Set I to the location of the font sprite for VX
+            // movzx eax, byte [rdi + VX]; lea eax, [rax + rax * 4]; mov word [rdi + I], ax
+            emit8(jit, 0x0F); emit8(jit, 0xB6); emit_mem(jit, REG_AX, OFFSET_V(X));
+            emit8(jit, 0x8D); emit8(jit, 0x04); emit8(jit, 0x80);
+            emit8(jit, 0x66); emit8(jit, 0x89); emit_mem(jit, REG_AX, OFFSET_I);
+            return JIT_EMIT_NEXT;
+
+        default:
+            // FX18 too, jit_run stops where it switches the tone
+            return JIT_EMIT_UNSUPPORTED;
+        }
+
+    default:
+        // CXNN, DXYN and EXNN are left to the interpreter
+        return JIT_EMIT_UNSUPPORTED;
+    }
+}
+
+static void jit_emit_block(Jit* jit, const Chip8* chip8, uint16_t start)
+{
+    JitBlock* block = &jit->blocks[start];
+
+    const size_t block_start = jit->used;
+    uint16_t pc = start;
+    uint8_t inst_count = 0;
+    JitEmitResult result = JIT_EMIT_NEXT;
+
+    while (inst_count < JIT_MAX_BLOCK_INSTRUCTIONS && pc + 1 < RAM_CAPACITY) {
+        const uint16_t opcode = (chip8->ram[pc] << 8) | (chip8->ram[pc + 1]);
+        const uint16_t next = (chip8->ram[(pc + 2) % RAM_CAPACITY] << 8) |
+            chip8->ram[(pc + 3) % RAM_CAPACITY];
+
+        result = jit_emit(jit, chip8->quirks, opcode, pc, next);
+
+        if (result == JIT_EMIT_UNSUPPORTED) {
+            break;
+        }
+
+        inst_count++;
+        pc += 2;
+
+        if (result == JIT_EMIT_END) {
+            break;
+        }
+    }
+
+    if (inst_count == 0) {
+        // Nothing to compile, remember to go straight to the interpreter
+        block->interpret = true;
+        block->length = 2;
+        return;
+    }
+
+    if (result != JIT_EMIT_END) {
+        // Straight-line block, continue after its last instruction
+        emit_store16_imm(jit, OFFSET_PC, pc);
+    }
+
+    // mov eax, inst_count; ret
+    emit_mov32_imm(jit, REG_AX, inst_count);
+    emit8(jit, 0xC3);
+
+    block->code = (JitFunction)(void*)(jit->buffer + block_start);
+    block->inst_count = inst_count;
+
+    // A block ending in a skip also depends on the opcode after it
+    block->length = pc - start + (result == JIT_EMIT_END ? 2 : 0);
+}
+
+static void jit_compile(Jit* jit, const Chip8* chip8, uint16_t start)
+{
+    JitBlock* block = &jit->blocks[start];
+
+    if (JIT_BUFFER_SIZE - jit->used < JIT_MAX_BLOCK_SIZE) {
+        // Out of code space, start over
+        jit_flush(jit);
+    }
+
+    // The buffer is writable only while a block is emitted
+    const size_t block_start = jit->used;
+
+    if (!jit_protect(jit, block_start, false)) {
+        fprintf(stderr, "ERROR: Could not make JIT memory writable, interpreting\n");
+        block->interpret = true;
+        block->length = 2;
+        return;
+    }
+
+    jit_emit_block(jit, chip8, start);
+
+    if (!jit_protect(jit, block_start, true)) {
+        // No block can run from a buffer that is not executable
+        fprintf(stderr, "ERROR: Could not make JIT memory executable, interpreting\n");
+        jit_flush(jit);
+        block->interpret = true;
+        block->length = 2;
+    }
+}
+
+static void jit_invalidate(Jit* jit, uint16_t address, uint16_t length)
+{
+    // Drop every block overlapping [address, address + length)
+    const uint16_t max_length = JIT_MAX_BLOCK_INSTRUCTIONS * 2 + 2;
+    const uint32_t end = address + length;
+    uint32_t start = address >= max_length ? address - max_length : 0;
+
+    for (; start < end && start < RAM_CAPACITY; ++start) {
+        JitBlock* block = &jit->blocks[start];
+
+        if (start + block->length > address) {
+            memset(block, 0, sizeof(JitBlock));
+        }
+    }
+}
+
+static void jit_interpret(Jit* jit, Chip8* chip8)
+{
+    const uint16_t pc = chip8->PC % RAM_CAPACITY;
+    const uint16_t opcode = (chip8->ram[pc] << 8) | (chip8->ram[(pc + 1) % RAM_CAPACITY]);
+    const uint16_t store_address = chip8->I % RAM_CAPACITY;
+    uint16_t store_length = 0;
+
+    // Remember which bytes the RAM stores are about to overwrite
+    if ((opcode & 0xF0FF) == 0xF033) {
+        store_length = 3;
+    } else if ((opcode & 0xF0FF) == 0xF055) {
+        store_length = ((opcode >> 8) & 0x0F) + 1;
+    } else if ((opcode & 0xF00F) == 0x5002) {
+        const uint8_t x = (opcode >> 8) & 0x0F;
+        const uint8_t y = (opcode >> 4) & 0x0F;
+        store_length = (x <= y ? y - x : x - y) + 1;
+    }
+
+    chip8_execute(chip8);
+
+    if (store_length > 0) {
+        jit_invalidate(jit, store_address, store_length);
+
+        // Stores wrap around the end of RAM
+        if (store_address + store_length > RAM_CAPACITY) {
+            jit_invalidate(jit, 0, store_address + store_length - RAM_CAPACITY);
+        }
+    }
+}
+
+uint32_t jit_run(Jit* jit, Chip8* chip8, uint32_t count)
+{
+    uint32_t executed = 0;
+    chip8->idle = CHIP8_RUNNING;
+    chip8->sound_edge = false;
+
+    while (executed < count) {
+        const uint16_t pc = chip8->PC;
+        JitBlock* block = &jit->blocks[pc];
+
+        if (!block->code && !block->interpret) {
+            jit_compile(jit, chip8, pc);
+        }
+
+        // Only run whole blocks that fit in the remaining budget
+        if (block->code && block->inst_count <= count - executed) {
+            executed += block->code(chip8);
+
+            if (chip8->PC <= pc) {
+                executed += chip8_fast_forward(chip8, count - executed);
+            }
+
+            continue;
+        }
+
+        jit_interpret(jit, chip8);
+        executed++;
+
+        // FX18 is always interpreted, stop where it switched the tone
+        if (chip8->sound_edge) {
+            break;
+        }
+
+        if (chip8->PC <= pc) {
+            executed += chip8_fast_forward(chip8, count - executed);
+        }
+    }
+
+    return executed;
+}
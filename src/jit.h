@@ -0,0 +1,37 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip.h"
+
+#define JIT_BUFFER_SIZE (1024 * 1024)   // Executable memory for compiled blocks
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64  // Longest straight-line run per block
+
+// Compiled block entry point, returns the number of instructions executed
+typedef uint32_t (*JitFunction)(Chip8* chip8);
+
+typedef struct JitBlock
+{
+    JitFunction code;     // NULL when no native code exists for this address
+    uint8_t inst_count;   // Instructions executed by one call of the block
+    uint8_t length;       // CHIP-8 bytes covered by the block
+    bool interpret;       // First instruction cannot be compiled
+} JitBlock;
+
+typedef struct Jit
+{
+    uint8_t* buffer;      // Executable code buffer
+    size_t used;          // Bytes of the buffer already holding code
+
+    JitBlock blocks[RAM_CAPACITY]; // Blocks keyed by their starting PC
+} Jit;
+
+bool jit_init(Jit* jit);
+void jit_cleanup(const Jit* jit);
+void jit_flush(Jit* jit);
+uint32_t jit_run(Jit* jit, Chip8* chip8, uint32_t count);
+
+#endif // _JIT_H_
@@ -0,0 +1,408 @@
+#define _DEFAULT_SOURCE // mmap
+
+#include "library.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "chip.h"
+
+// Archive layout, little endian:
+//  "C8LB", version u16, ROM count u32, then per ROM the offset of its
+//  zero terminated name u32, offset of its image u32, image size u32 and
+//  SHA-1 of the image (20 bytes), then the names and images. Offsets are
+//  from the start of the file, so the mapped file is the library's data
+
+#define LIBRARY_HEADER_SIZE (4 + 2 + 4)
+#define LIBRARY_ENTRY_SIZE (4 + 4 + 4 + ROMDB_HASH_SIZE)
+
+static uint8_t* library_put(uint8_t* out, uint64_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; ++i) {
+        out[i] = (value >> (i * 8)) & 0xFF;
+    }
+
+    return out + bytes;
+}
+
+static const uint8_t* library_get(const uint8_t* in, uint64_t* value, uint8_t bytes)
+{
+    *value = 0;
+
+    for (uint8_t i = 0; i < bytes; ++i) {
+        *value |= (uint64_t)in[i] << (i * 8);
+    }
+
+    return in + bytes;
+}
+
+static int library_compare_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void library_append(Library* library, const void* data, size_t size)
+{
+    if (library->size + size > library->capacity) {
+        while (library->size + size > library->capacity) {
+            library->capacity = library->capacity ? library->capacity * 2 : 64 * 1024;
+        }
+
+        library->data = realloc(library->data, library->capacity);
+    }
+
+    memcpy(library->data + library->size, data, size);
+    library->size += size;
+}
+
+static RomImage* library_new_rom(Library* library)
+{
+    if (library->count == library->rom_capacity) {
+        library->rom_capacity = library->rom_capacity ? library->rom_capacity * 2 : 64;
+        library->roms = realloc(library->roms, library->rom_capacity * sizeof(RomImage));
+    }
+
+    return &library->roms[library->count++];
+}
+
+bool library_add_file(Library* library, const char* path)
+{
+    // Read once, every later load comes from memory. The library must be
+    //  zeroed or filled by library_add_file before
+    uint8_t* image = malloc(MAX_ROM_SIZE);
+    size_t size;
+
+    if (!image || !chip8_read_rom(path, image, &size)) {
+        free(image);
+        return false;
+    }
+
+    RomImage* rom = library_new_rom(library);
+    rom->name = library->size;
+    library_append(library, path, strlen(path) + 1);
+    rom->offset = library->size;
+    rom->size = size;
+    library_append(library, image, size);
+    romdb_hash(image, size, rom->hash);
+
+    free(image);
+
+    return true;
+}
+
+bool library_add_directory(Library* library, const char* path)
+{
+    // Every regular file in the directory, in name order so indices are
+    //  the same on every run. Same requirements as library_add_file
+    DIR* directory = opendir(path);
+
+    if (!directory) {
+        fprintf(stderr, "ERROR: Could not open ROM directory \"%s\"\n", path);
+        return false;
+    }
+
+    char** names = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    for (struct dirent* entry; (entry = readdir(directory));) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            names = realloc(names, capacity * sizeof(char*));
+        }
+
+        const size_t length = strlen(path) + 1 + strlen(entry->d_name) + 1;
+        names[count] = malloc(length);
+        snprintf(names[count], length, "%s/%s", path, entry->d_name);
+        ++count;
+    }
+
+    closedir(directory);
+    qsort(names, count, sizeof(char*), library_compare_names);
+
+    for (size_t i = 0; i < count; ++i) {
+        struct stat info;
+
+        // Unreadable or oversized files were reported, the rest still load
+        if (stat(names[i], &info) == 0 && S_ISREG(info.st_mode)) {
+            library_add_file(library, names[i]);
+        }
+
+        free(names[i]);
+    }
+
+    free(names);
+
+    return true;
+}
+
+static bool library_map(Library* library, const char* path)
+{
+#ifdef _WIN32
+    // No mmap, read the whole archive instead
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open ROM archive \"%s\"\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+
+    uint8_t* data = malloc(size > 0 ? size : 1);
+    const bool ok = size > 0 && fread(data, size, 1, file) == 1;
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not read ROM archive \"%s\"\n", path);
+        free(data);
+        return false;
+    }
+
+    library->data = data;
+    library->size = size;
+    library->capacity = size;
+#else
+    const int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Could not open ROM archive \"%s\"\n", path);
+        return false;
+    }
+
+    struct stat info;
+    void* data = MAP_FAILED;
+
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    // The mapping stays valid after closing
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Could not map ROM archive \"%s\"\n", path);
+        return false;
+    }
+
+    library->data = data;
+    library->size = info.st_size;
+    library->capacity = 0;
+#endif
+
+    return true;
+}
+
+static bool library_load_archive(Library* library, const char* path)
+{
+    if (!library_map(library, path)) {
+        return false;
+    }
+
+    uint64_t version;
+    uint64_t count;
+
+    if (library->size < LIBRARY_HEADER_SIZE || memcmp(library->data, "C8LB", 4) != 0) {
+        fprintf(stderr, "ERROR: \"%s\" is not a ROM archive\n", path);
+        return false;
+    }
+
+    const uint8_t* in = library_get(library->data + 4, &version, 2);
+    in = library_get(in, &count, 4);
+
+    if (version != LIBRARY_VERSION) {
+        fprintf(stderr, "ERROR: Unsupported ROM archive version %u\n", (unsigned)version);
+        return false;
+    }
+
+    if (count > (library->size - LIBRARY_HEADER_SIZE) / LIBRARY_ENTRY_SIZE) {
+        fprintf(stderr, "ERROR: ROM archive \"%s\" is truncated\n", path);
+        return false;
+    }
+
+    library->roms = malloc((count ? count : 1) * sizeof(RomImage));
+    library->count = count;
+    library->rom_capacity = count;
+
+    // Only the index is read, images are paged in when first loaded
+    for (uint32_t i = 0; i < count; ++i) {
+        RomImage* rom = &library->roms[i];
+        uint64_t name;
+        uint64_t offset;
+        uint64_t size;
+
+        in = library_get(in, &name, 4);
+        in = library_get(in, &offset, 4);
+        in = library_get(in, &size, 4);
+        memcpy(rom->hash, in, ROMDB_HASH_SIZE);
+        in += ROMDB_HASH_SIZE;
+
+        if (name >= library->size || !memchr(library->data + name, '\0', library->size - name) ||
+            offset > library->size || size > library->size - offset || size > MAX_ROM_SIZE) {
+            fprintf(stderr, "ERROR: Corrupt ROM archive \"%s\"\n", path);
+            return false;
+        }
+
+        rom->name = name;
+        rom->offset = offset;
+        rom->size = size;
+    }
+
+    return true;
+}
+
+bool library_is_collection(const char* path)
+{
+    // A directory or a packed archive, anything else is a single ROM or list
+    struct stat info;
+
+    if (stat(path, &info) != 0) {
+        return false;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        return true;
+    }
+
+    FILE* file = fopen(path, "rb");
+    char magic[4];
+    const bool archive = file && fread(magic, sizeof(magic), 1, file) == 1 &&
+        memcmp(magic, "C8LB", 4) == 0;
+
+    if (file) {
+        fclose(file);
+    }
+
+    return archive;
+}
+
+bool library_open(Library* library, const char* path)
+{
+    memset(library, 0, sizeof(Library));
+
+    struct stat info;
+    const bool directory = stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+
+    if (!(directory ? library_add_directory(library, path) : library_load_archive(library, path))) {
+        library_close(library);
+        memset(library, 0, sizeof(Library));
+        return false;
+    }
+
+    if (library->count == 0) {
+        fprintf(stderr, "ERROR: No ROMs in \"%s\"\n", path);
+        library_close(library);
+        memset(library, 0, sizeof(Library));
+        return false;
+    }
+
+    return true;
+}
+
+bool library_save(const Library* library, const char* path)
+{
+    // Index first, then name and image of every ROM in library order
+    size_t size = LIBRARY_HEADER_SIZE + (size_t)library->count * LIBRARY_ENTRY_SIZE;
+
+    for (uint32_t i = 0; i < library->count; ++i) {
+        size += strlen(library_name(library, i)) + 1 + library->roms[i].size;
+    }
+
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "ERROR: ROM archive would exceed 4 GB\n");
+        return false;
+    }
+
+    uint8_t* data = malloc(size);
+
+    if (!data) {
+        fprintf(stderr, "ERROR: Could not allocate ROM archive\n");
+        return false;
+    }
+
+    memcpy(data, "C8LB", 4);
+    uint8_t* index = library_put(data + 4, LIBRARY_VERSION, 2);
+    index = library_put(index, library->count, 4);
+    uint8_t* out = index + (size_t)library->count * LIBRARY_ENTRY_SIZE;
+
+    for (uint32_t i = 0; i < library->count; ++i) {
+        const RomImage* rom = &library->roms[i];
+        const char* name = library_name(library, i);
+        const size_t name_size = strlen(name) + 1;
+
+        index = library_put(index, out - data, 4);
+        memcpy(out, name, name_size);
+        out += name_size;
+
+        index = library_put(index, out - data, 4);
+        index = library_put(index, rom->size, 4);
+        memcpy(index, rom->hash, ROMDB_HASH_SIZE);
+        index += ROMDB_HASH_SIZE;
+
+        memcpy(out, library_image(library, i), rom->size);
+        out += rom->size;
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open ROM archive \"%s\"\n", path);
+        free(data);
+        return false;
+    }
+
+    const bool ok = fwrite(data, size, 1, file) == 1;
+    fclose(file);
+    free(data);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not write ROM archive \"%s\"\n", path);
+    }
+
+    return ok;
+}
+
+void library_close(const Library* library)
+{
+    free(library->roms);
+
+#ifndef _WIN32
+    if (library->data && library->capacity == 0) {
+        munmap(library->data, library->size);
+        return;
+    }
+#endif
+
+    free(library->data);
+}
+
+bool library_find(const Library* library, const char* name, uint32_t* index)
+{
+    // By the name as listed or by its file name alone
+    for (uint32_t i = 0; i < library->count; ++i) {
+        const char* listed = library_name(library, i);
+        const char* file_name = strrchr(listed, '/');
+
+        if (strcmp(listed, name) == 0 || (file_name && strcmp(file_name + 1, name) == 0)) {
+            *index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,53 @@
+#ifndef _LIBRARY_H_
+#define _LIBRARY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "romdb.h"
+
+// ROM images held in memory for a whole session, so resets, ROM switches
+//  and batch jobs never go back to the disk. Filled from a directory, a
+//  packed archive (mapped as is) or single files and stdin
+
+#define LIBRARY_VERSION 1
+
+typedef struct RomImage
+{
+    uint32_t name;   // Offsets into Library.data, the name is zero terminated
+    uint32_t offset;
+    uint32_t size;
+    uint8_t hash[ROMDB_HASH_SIZE]; // SHA-1 of the image, the ROM database key
+} RomImage;
+
+typedef struct Library
+{
+    uint8_t* data;    // Names and images, mapped for archives
+    size_t size;
+    size_t capacity;  // 0 when data is mapped
+    RomImage* roms;
+    uint32_t count;
+    uint32_t rom_capacity;
+} Library;
+
+bool library_is_collection(const char* path);
+bool library_open(Library* library, const char* path);
+bool library_add_file(Library* library, const char* path);
+bool library_add_directory(Library* library, const char* path);
+bool library_save(const Library* library, const char* path);
+void library_close(const Library* library);
+
+bool library_find(const Library* library, const char* name, uint32_t* index);
+
+static inline const char* library_name(const Library* library, uint32_t index)
+{
+    return (const char*)library->data + library->roms[index].name;
+}
+
+static inline const uint8_t* library_image(const Library* library, uint32_t index)
+{
+    return library->data + library->roms[index].offset;
+}
+
+#endif // _LIBRARY_H_
@@ -1,57 +1,413 @@
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "emu.h"
 #include "chip.h"
+#include "batch.h"
+#include "profile.h"
+#include "romdb.h"
+#include "library.h"
+
+static void print_usage(void)
+{
+    fprintf(stderr,
+        "Usage: chip8emu [options] <rom file, - for stdin>\n"
+        "       chip8emu [options] --library <directory or archive> [<rom name>]\n"
+        "  --jit                         Run compiled x86-64 blocks\n"
+        "  --quirks <profile>            chip8, schip, amiga or xochip (default from the ROM database)\n"
+        "  --ips <n>                     Instructions per second (default from the ROM database)\n"
+        "  --db <file>                   ROM database (default " ROMDB_FILE " next to the executable)\n"
+        "  --seed <n>                    RNG seed for CXNN (default current time)\n"
+        "  --vsync                       Pace rendering by the display refresh\n"
+        "  --turbo                       Start uncapped, toggle with Tab\n"
+        "  --audio-samples <n>           Audio device buffer, power of two (default 256)\n"
+        "  --record <movie>              Record keypad input for replaying\n"
+        "  --replay <movie>              Replay a movie headlessly and check the result\n"
+        "  --headless                    Run without window, audio or input\n"
+        "  --frames <n>                  Stop headless runs after n frames\n"
+        "  --video <file>                Write every frame as raw 128x64 video, - for stdout\n"
+        "  --video-format <format>       rgba or mono (1 bit per pixel), default rgba\n"
+        "  --pcm <file>                  Write the sound as raw 44.1 kHz s16le PCM, - for stdout\n"
+        "  --library <path>              Load every ROM of a directory or archive, switch with PgUp/PgDn\n"
+        "  --batch <list file>           Run every ROM in the list, directory or archive headlessly\n"
+        "  --threads <n>                 Batch worker threads (default all cores)\n"
+#ifdef DEBUG
+        "  --trace-at <address>          Dump the trace when PC reaches the address\n"
+#endif
+        );
+}
+
+static double seconds_now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void default_db_path(const char* program, char* path, size_t size)
+{
+    // Installed next to the executable, the directory part of argv[0]
+    size_t directory = strlen(program);
+
+    while (directory > 0 && program[directory - 1] != '/' && program[directory - 1] != '\\') {
+        --directory;
+    }
+
+    snprintf(path, size, "%.*s%s", (int)directory, program, ROMDB_FILE);
+}
+
+static int run_headless(Emulator* emu, uint64_t frames)
+{
+    // Run as fast as possible, frames == 0 runs forever
+    const double start = seconds_now();
+    uint64_t frame = 0;
+    uint64_t instructions = 0;
+
+    for (; frames == 0 || frame < frames; ++frame) {
+        // One frame of emulated time, ending on its timer tick
+        const uint32_t count = chip8_instructions_to_tick(&emu->chip8);
+        emu_advance(emu, count);
+        instructions += count;
+        PROFILE_FRAME(&emu->chip8, emu->instructions);
+    }
+
+    const double elapsed = seconds_now() - start;
+
+    printf("INFO: Ran %llu frames (%llu instructions) in %.3f s\n",
+        (unsigned long long)frame, (unsigned long long)instructions, elapsed);
+
+    return EXIT_SUCCESS;
+}
+
+static int run_replay(Emulator* emu, const Movie* movie)
+{
+    // Re-simulate the recorded session as fast as possible
+    if (movie_rom_hash(&emu->chip8) != movie->rom_hash) {
+        fprintf(stderr, "ERROR: The movie was recorded with a different ROM\n");
+        return EXIT_FAILURE;
+    }
+
+    const double start = seconds_now();
+    const bool match = emu_replay(emu, movie);
+    const double elapsed = seconds_now() - start;
+
+    printf("INFO: Replayed %zu key events over %llu instructions in %.3f s\n",
+        movie->count, (unsigned long long)emu->instructions, elapsed);
+
+    if (!match) {
+        fprintf(stderr, "ERROR: Replay did not end in the recorded state\n");
+        return EXIT_FAILURE;
+    }
+
+    puts("INFO: Replay ended in the recorded state");
+    return EXIT_SUCCESS;
+}
+
+static int run_emulation(void* data)
+{
+    // Emulation thread, paced by real time and publishing every changed
+    //  display for the render thread
+    Emulator* emu = data;
+    emu_publish_frame(emu);
+
+    while (emu->state != STATE_QUIT) {
+        PROFILE_BEGIN(PROFILE_EVENTS);
+        emu_run_commands(emu);
+        PROFILE_END(&emu->chip8, PROFILE_EVENTS);
+
+        if (emu->state == STATE_QUIT) {
+            break;
+        }
+
+        if (emu->state == STATE_PAUSED || emu_blocked(emu)) {
+            // Paused, or the ROM waits for input: sleep instead of
+            //  emulating frames in which nothing can happen
+            emu_publish_frame(emu);
+            emu_sleep(emu);
+            continue;
+        }
+
+        if (emu->rewinding) {
+            // Play recorded frames backwards at the normal frame rate
+            emu_rewind(emu);
+        } else if (emu->turbo) {
+            // Run as fast as the host allows until the next frame is due
+            emu_run_turbo(emu);
+        } else {
+            // Emulate the instructions owed for the real time that passed
+            emu_schedule(emu);
+        }
+
+        // Hand the display over, skipped when it is unchanged
+        PROFILE_BEGIN(PROFILE_RENDER);
+        emu_publish_frame(emu);
+        PROFILE_END(&emu->chip8, PROFILE_RENDER);
+        PROFILE_FRAME(&emu->chip8, emu->instructions);
+
+        if (!emu->turbo || emu->rewinding) {
+            emu_wait_frame(emu);
+        }
+
+        emu_report_speed(emu);
+    }
+
+    return 0;
+}
 
 int main(int argc, char** argv)
 {
-    if (argc <= 1) {
-        fprintf(stderr, "Usage: chip8emu <rom file>\n");
+    EmulatorConfig config = {
+        .quirks = QUIRKS_CHIP8,
+        .seed = time(NULL),
+        .audio_samples = AUDIO_SAMPLES
+    };
+    uint64_t frames = 0;
+    const char* batch_list = NULL;
+    const char* replay_file = NULL;
+    const char* db_file = NULL;
+    const char* library_path = NULL;
+    const char* rom_name = NULL;
+    uint32_t threads = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            config.use_jit = true;
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            config.vsync = true;
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            config.turbo = true;
+        } else if (strcmp(argv[i], "--audio-samples") == 0 && i + 1 < argc) {
+            const unsigned long samples = strtoul(argv[++i], NULL, 10);
+
+            if (samples < 16 || samples > AUDIO_MAX_SAMPLES || (samples & (samples - 1))) {
+                fprintf(stderr, "ERROR: Audio buffer must be a power of two up to %d samples\n",
+                    AUDIO_MAX_SAMPLES);
+                return EXIT_FAILURE;
+            }
+
+            config.audio_samples = samples;
+        } else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc) {
+            const unsigned long ips = strtoul(argv[++i], NULL, 10);
+
+            if (ips < CHIP_MIN_INST_PER_SECOND || ips > CHIP_MAX_INST_PER_SECOND) {
+                fprintf(stderr, "ERROR: Speed must be %d to %d instructions per second\n",
+                    CHIP_MIN_INST_PER_SECOND, CHIP_MAX_INST_PER_SECOND);
+                return EXIT_FAILURE;
+            }
+
+            config.ips = ips;
+        } else if (strcmp(argv[i], "--library") == 0 && i + 1 < argc) {
+            library_path = argv[++i];
+        } else if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+            db_file = argv[++i];
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            config.headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            config.seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--video") == 0 && i + 1 < argc) {
+            config.video_file = argv[++i];
+        } else if (strcmp(argv[i], "--video-format") == 0 && i + 1 < argc) {
+            if (!capture_format_from_name(argv[++i], &config.video_format)) {
+                fprintf(stderr, "ERROR: Unknown video format \"%s\"\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--pcm") == 0 && i + 1 < argc) {
+            config.pcm_file = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            config.record_file = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_file = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_list = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtoul(argv[++i], NULL, 10);
+#ifdef DEBUG
+        } else if (strcmp(argv[i], "--trace-at") == 0 && i + 1 < argc) {
+            config.trace_trigger = strtoul(argv[++i], NULL, 0);
+#endif
+        } else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+            if (!chip8_quirks_from_name(argv[++i], &config.quirks)) {
+                fprintf(stderr, "ERROR: Unknown quirk profile \"%s\"\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+
+            config.quirks_given = true;
+        } else {
+            rom_name = argv[i];
+        }
+    }
+
+    // A stream on stdout must not get mixed with the INFO lines
+    if (((config.video_file && strcmp(config.video_file, "-") == 0) ||
+        (config.pcm_file && strcmp(config.pcm_file, "-") == 0)) && !capture_take_stdout()) {
+        return EXIT_FAILURE;
+    }
+
+    // A missing default database only means every ROM runs with defaults
+    static RomDb db;
+    char db_path[4096];
+
+    if (!db_file) {
+        default_db_path(argv[0], db_path, sizeof(db_path));
+
+        if (!replay_file && !romdb_open(&db, db_path)) {
+            printf("INFO: No ROM database at \"%s\"\n", db_path);
+        }
+    } else if (!romdb_open(&db, db_file)) {
+        fprintf(stderr, "ERROR: Could not open ROM database \"%s\"\n", db_file);
+        return EXIT_FAILURE;
+    }
+
+    if (batch_list) {
+        const BatchConfig batch = {
+            .list_file = batch_list,
+            .frames = frames,
+            .threads = threads,
+            .seed = config.seed,
+            .db = &db,
+            .quirks = config.quirks,
+            .quirks_given = config.quirks_given,
+            .ips = config.ips,
+            .use_jit = config.use_jit
+        };
+
+        const bool ok = batch_run(batch);
+        romdb_close(&db);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Every ROM is read once and started from memory from then on
+    static Library library;
+
+    if (library_path) {
+        if (!library_open(&library, library_path)) {
+            romdb_close(&db);
+            return EXIT_FAILURE;
+        }
+
+        if (rom_name && !library_find(&library, rom_name, &config.rom)) {
+            fprintf(stderr, "ERROR: No ROM \"%s\" in \"%s\"\n", rom_name, library_path);
+            library_close(&library);
+            romdb_close(&db);
+            return EXIT_FAILURE;
+        }
+
+        printf("INFO: Loaded %u ROMs from \"%s\"\n", library.count, library_path);
+    } else if (!rom_name) {
+        print_usage();
+        romdb_close(&db);
+        return EXIT_FAILURE;
+    } else if (!library_add_file(&library, rom_name)) {
+        romdb_close(&db);
         return EXIT_FAILURE;
     }
 
-    const char* rom_path = argv[1];
+    config.library = &library;
+    config.db = &db;
+
+    static Movie movie;
+
+    if (replay_file) {
+        // The movie decides how the machine starts
+        if (!movie_load(&movie, replay_file)) {
+            return EXIT_FAILURE;
+        }
+
+        config.quirks = movie.quirks;
+        config.quirks_given = true;
+        config.ips = movie.ips;
+        config.seed = movie.seed;
+        config.headless = true;
+        config.record_file = NULL;
+    }
+
+#if defined(PROFILE) || defined(DEBUG)
+    // Compiled blocks bypass the interpreter, they would be neither counted nor traced
+    if (config.use_jit) {
+        puts("INFO: Profiling or debug build, running the interpreter instead of --jit");
+        config.use_jit = false;
+    }
+#endif
 
-    Emulator emu;
+    static Emulator emu;
 
-    if (!emu_init(&emu, rom_path)) {
+    if (!emu_init(&emu, config)) {
         fprintf(stderr, "ERROR: Could not initialize emulator\n");
         return EXIT_FAILURE;
     }
 
-    while (emu.state != STATE_QUIT) {
-        emu_handle_events(&emu);
+    PROFILE_START(&emu.chip8);
 
-        if (emu.state == STATE_PAUSED) {
-            continue;
+    if (replay_file) {
+        int status = run_replay(&emu, &movie);
+        PROFILE_FINISH(&emu.chip8, emu.rom_file);
+
+        if (!emu_stop_capture(&emu)) {
+            status = EXIT_FAILURE;
+        }
+
+        movie_cleanup(&movie);
+        emu_cleanup(&emu);
+        library_close(&library);
+        romdb_close(&db);
+        return status;
+    }
+
+    if (config.headless) {
+        int status = run_headless(&emu, frames);
+        PROFILE_FINISH(&emu.chip8, emu.rom_file);
+
+#ifdef DEBUG
+        // No key to dump with, keep the end of the run unless a trigger did
+        if (!emu.trace_dumped) {
+            emu_dump_trace(&emu);
         }
+#endif
 
-        // Get time before running instructions
-        uint64_t start_timer = SDL_GetPerformanceCounter();
+        emu_stop_recording(&emu);
 
-        // Emulate CHIP-8 instructions for this frame (60 Hz)
-        for (uint32_t i = 0; i < CHIP_INST_PER_SECOND / FPS; ++i) {
-            chip8_execute(&emu.chip8);
+        if (!emu_stop_capture(&emu)) {
+            status = EXIT_FAILURE;
         }
 
-        // Get time after running instructions
-        uint64_t end_timer = SDL_GetPerformanceCounter();
+        emu_cleanup(&emu);
+        library_close(&library);
+        romdb_close(&db);
+        return status;
+    }
 
-        // Delay for 60 fps
-        const double time_elapsed = (double)((end_timer - start_timer) * 1000) / SDL_GetPerformanceFrequency();
-        const double delay = (1000 / FPS) > time_elapsed ? (1000 / FPS) - time_elapsed : 0;
-        SDL_Delay(delay);
+    // The core runs on its own thread, so a slow present or a vsync
+    //  stall never holds up emulated time. This one handles the window
+    SDL_Thread* thread = SDL_CreateThread(run_emulation, "emulation", &emu);
 
-        // Clear and update the emulator screen
-        emu_clear_screen(emu);
-        emu_update_screen(emu);
+    if (!thread) {
+        fprintf(stderr, "ERROR: Could not start the emulation thread: %s\n", SDL_GetError());
+        PROFILE_FINISH(&emu.chip8, emu.rom_file);
+        emu_stop_capture(&emu);
+        emu_cleanup(&emu);
+        library_close(&library);
+        romdb_close(&db);
+        return EXIT_FAILURE;
+    }
 
-        // Update emulator timers
-        emu_update_timers(&emu);
+    while (!emu.quit) {
+        // Block until input or a published frame, then present the newest one
+        emu_wait_events(&emu);
+        emu_update_screen(&emu);
     }
 
-    emu_cleanup(emu);
+    SDL_WaitThread(thread, NULL);
 
-    return EXIT_SUCCESS;
+    PROFILE_FINISH(&emu.chip8, emu.rom_file);
+    emu_stop_recording(&emu);
+    const bool captured = emu_stop_capture(&emu);
+    emu_cleanup(&emu);
+    library_close(&library);
+    romdb_close(&db);
+
+    return captured ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -0,0 +1,215 @@
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// File layout, little endian:
+//  "C8MV", version u16, quirks u8, instructions per second u16, seed u64,
+//  ROM hash u64, length u64, state hash u64, event count u32, then per
+//  event a LEB128 varint of instructions since the previous event and one
+//  byte key | pressed << 7
+
+#define MOVIE_HEADER_SIZE (4 + 2 + 1 + 2 + 8 + 8 + 8 + 8 + 4)
+
+static uint64_t movie_fnv(uint64_t hash, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+uint64_t movie_rom_hash(const Chip8* chip8)
+{
+    // Program area as loaded, call before running anything
+    return movie_fnv(0xCBF29CE484222325, &chip8->ram[CHIP_ENTRY_POINT], MAX_ROM_SIZE);
+}
+
+uint64_t movie_state_hash(const Chip8* chip8)
+{
+    uint8_t state[CHIP8_STATE_SIZE];
+    const size_t size = chip8_save_state(chip8, state, sizeof(state));
+
+    return movie_fnv(0xCBF29CE484222325, state, size);
+}
+
+static uint8_t* movie_put(uint8_t* out, uint64_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; ++i) {
+        out[i] = (value >> (i * 8)) & 0xFF;
+    }
+
+    return out + bytes;
+}
+
+static const uint8_t* movie_get(const uint8_t* in, uint64_t* value, uint8_t bytes)
+{
+    *value = 0;
+
+    for (uint8_t i = 0; i < bytes; ++i) {
+        *value |= (uint64_t)in[i] << (i * 8);
+    }
+
+    return in + bytes;
+}
+
+void movie_start(Movie* movie, const Chip8* chip8, uint64_t seed)
+{
+    memset(movie, 0, sizeof(Movie));
+    movie->rom_hash = movie_rom_hash(chip8);
+    movie->seed = seed;
+    movie->quirks = chip8->quirks;
+    movie->ips = chip8->ips;
+}
+
+void movie_record(Movie* movie, uint64_t instruction, uint8_t key, bool pressed)
+{
+    if (movie->count == movie->capacity) {
+        movie->capacity = movie->capacity ? movie->capacity * 2 : 256;
+        movie->events = realloc(movie->events, movie->capacity * sizeof(MovieEvent));
+    }
+
+    movie->events[movie->count++] = (MovieEvent){ instruction, key, pressed };
+}
+
+void movie_finish(Movie* movie, const Chip8* chip8, uint64_t instruction)
+{
+    movie->length = instruction;
+    movie->state_hash = movie_state_hash(chip8);
+}
+
+bool movie_save(const Movie* movie, const char* path)
+{
+    // Varints take at most 10 bytes
+    uint8_t* data = malloc(MOVIE_HEADER_SIZE + movie->count * 11);
+    uint8_t* out = data;
+
+    memcpy(out, "C8MV", 4);
+    out = movie_put(out + 4, MOVIE_VERSION, 2);
+    out = movie_put(out, movie->quirks, 1);
+    out = movie_put(out, movie->ips, 2);
+    out = movie_put(out, movie->seed, 8);
+    out = movie_put(out, movie->rom_hash, 8);
+    out = movie_put(out, movie->length, 8);
+    out = movie_put(out, movie->state_hash, 8);
+    out = movie_put(out, movie->count, 4);
+
+    uint64_t previous = 0;
+
+    for (size_t i = 0; i < movie->count; ++i) {
+        const MovieEvent* event = &movie->events[i];
+        uint64_t delta = event->instruction - previous;
+        previous = event->instruction;
+
+        while (delta >= 0x80) {
+            *out++ = (delta & 0x7F) | 0x80;
+            delta >>= 7;
+        }
+
+        *out++ = delta;
+        *out++ = event->key | (event->pressed << 7);
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open movie file \"%s\"\n", path);
+        free(data);
+        return false;
+    }
+
+    const bool ok = fwrite(data, out - data, 1, file) == 1;
+    fclose(file);
+    free(data);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not write movie file \"%s\"\n", path);
+    }
+
+    return ok;
+}
+
+bool movie_load(Movie* movie, const char* path)
+{
+    memset(movie, 0, sizeof(Movie));
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open movie file \"%s\"\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+
+    uint8_t* data = malloc(size > 0 ? size : 1);
+    const bool read = size >= MOVIE_HEADER_SIZE && fread(data, size, 1, file) == 1;
+    fclose(file);
+
+    if (!read || memcmp(data, "C8MV", 4) != 0) {
+        fprintf(stderr, "ERROR: \"%s\" is not a CHIP-8 movie\n", path);
+        free(data);
+        return false;
+    }
+
+    uint64_t version;
+    uint64_t quirks;
+    uint64_t ips;
+    uint64_t count;
+    const uint8_t* in = movie_get(data + 4, &version, 2);
+
+    if (version != MOVIE_VERSION) {
+        fprintf(stderr, "ERROR: Unsupported movie version %u\n", (unsigned)version);
+        free(data);
+        return false;
+    }
+
+    in = movie_get(in, &quirks, 1);
+    in = movie_get(in, &ips, 2);
+    in = movie_get(in, &movie->seed, 8);
+    in = movie_get(in, &movie->rom_hash, 8);
+    in = movie_get(in, &movie->length, 8);
+    in = movie_get(in, &movie->state_hash, 8);
+    in = movie_get(in, &count, 4);
+    movie->quirks = quirks;
+    movie->ips = ips;
+
+    const uint8_t* end = data + size;
+    uint64_t instruction = 0;
+
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t delta = 0;
+        uint8_t shift = 0;
+
+        while (in < end && (*in & 0x80) && shift < 63) {
+            delta |= (uint64_t)(*in++ & 0x7F) << shift;
+            shift += 7;
+        }
+
+        if (end - in < 2) {
+            fprintf(stderr, "ERROR: Movie \"%s\" is truncated\n", path);
+            movie_cleanup(movie);
+            free(data);
+            return false;
+        }
+
+        delta |= (uint64_t)*in++ << shift;
+        instruction += delta;
+
+        const uint8_t key = *in++;
+        movie_record(movie, instruction, key & 0x0F, key >> 7);
+    }
+
+    free(data);
+
+    return true;
+}
+
+void movie_cleanup(const Movie* movie)
+{
+    free(movie->events);
+}
@@ -0,0 +1,46 @@
+#ifndef _MOVIE_H_
+#define _MOVIE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip.h"
+
+#define MOVIE_VERSION 3
+
+// Keypad transition at an emulated instruction index
+typedef struct MovieEvent
+{
+    uint64_t instruction; // Instructions run since loading when the key changed
+    uint8_t key;
+    bool pressed;
+} MovieEvent;
+
+typedef struct Movie
+{
+    // Everything needed to start the same run again
+    uint64_t rom_hash;
+    uint64_t seed;
+    uint8_t quirks;
+    uint16_t ips;
+
+    uint64_t length;     // Instructions covered by the movie
+    uint64_t state_hash; // Machine state after length instructions
+
+    MovieEvent* events;
+    size_t count;
+    size_t capacity;
+} Movie;
+
+void movie_start(Movie* movie, const Chip8* chip8, uint64_t seed);
+void movie_record(Movie* movie, uint64_t instruction, uint8_t key, bool pressed);
+void movie_finish(Movie* movie, const Chip8* chip8, uint64_t instruction);
+bool movie_save(const Movie* movie, const char* path);
+bool movie_load(Movie* movie, const char* path);
+void movie_cleanup(const Movie* movie);
+
+uint64_t movie_rom_hash(const Chip8* chip8);
+uint64_t movie_state_hash(const Chip8* chip8);
+
+#endif // _MOVIE_H_
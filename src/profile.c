@@ -0,0 +1,277 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Built only with -DPROFILE, see profile.h
+
+typedef struct ProfileEntry
+{
+    const char* name; // Opcode class, unused for addresses
+    uint16_t address;
+    uint64_t count;
+} ProfileEntry;
+
+static const char* g_phase_names[PROFILE_PHASE_COUNT] = {
+    "events", "execute", "render", "timers"
+};
+
+Profile* profile_create(void)
+{
+    Profile* profile = calloc(1, sizeof(Profile));
+
+    if (!profile) {
+        fprintf(stderr, "ERROR: Could not allocate profiler\n");
+        return NULL;
+    }
+
+    profile->frame_min = UINT64_MAX;
+
+    return profile;
+}
+
+void profile_destroy(Profile* profile)
+{
+    free(profile);
+}
+
+void profile_instruction(Profile* profile, const Chip8* chip8, uint16_t pc, uint16_t opcode)
+{
+    pc %= RAM_CAPACITY;
+    profile->addresses[pc]++;
+    profile->opcodes_at[pc] = opcode;
+    profile->opcodes[opcode]++;
+
+    // The call stack is identified by its return addresses
+    const ptrdiff_t used = chip8->stack_ptr - chip8->stack;
+    const uint8_t depth = used < 0 ? 0 : used > 12 ? 12 : used;
+    uint64_t hash = 0xCBF29CE484222325 ^ depth;
+
+    for (uint8_t i = 0; i < depth; ++i) {
+        hash ^= chip8->stack[i];
+        hash *= 0x100000001B3;
+    }
+
+    for (uint32_t probe = 0; probe < PROFILE_STACK_PROBES; ++probe) {
+        ProfileStack* stack = &profile->stacks[(hash + probe) % PROFILE_MAX_STACKS];
+
+        if (stack->count == 0) {
+            stack->depth = depth;
+            memcpy(stack->returns, chip8->stack, depth * sizeof(uint16_t));
+        } else if (stack->depth != depth ||
+            memcmp(stack->returns, chip8->stack, depth * sizeof(uint16_t)) != 0) {
+            continue;
+        }
+
+        stack->count++;
+        return;
+    }
+
+    profile->lost_stacks++;
+}
+
+void profile_frame(Profile* profile, uint64_t total)
+{
+    // total counts instructions since loading, frames get the difference
+    const uint64_t instructions = total - profile->last_instructions;
+    profile->last_instructions = total;
+    profile->frames++;
+
+    if (instructions < profile->frame_min) {
+        profile->frame_min = instructions;
+    }
+
+    if (instructions > profile->frame_max) {
+        profile->frame_max = instructions;
+    }
+}
+
+uint64_t profile_now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_add_time(Profile* profile, ProfilePhase phase, uint64_t start)
+{
+    profile->phase_ns[phase] += profile_now() - start;
+}
+
+static int profile_compare(const void* a, const void* b)
+{
+    // Most executed first, then by address
+    const ProfileEntry* left = a;
+    const ProfileEntry* right = b;
+
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+
+    return left->address - right->address;
+}
+
+static void profile_write_frame(FILE* file, const Chip8* chip8, uint16_t return_address)
+{
+    // Name a frame after the subroutine its 2NNN called, or after the
+    //  call site if that code has been overwritten since
+    const uint16_t site = (return_address - 2) % RAM_CAPACITY;
+    const uint16_t opcode = (chip8->ram[site] << 8) | chip8->ram[(site + 1) % RAM_CAPACITY];
+
+    if ((opcode & 0xF000) == 0x2000) {
+        fprintf(file, ";sub_%03X", opcode & 0x0FFF);
+    } else {
+        fprintf(file, ";call_%03X", site);
+    }
+}
+
+static bool profile_write_report(const Profile* profile, const char* rom_file, const char* path)
+{
+    FILE* file = fopen(path, "w");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open profile file \"%s\"\n", path);
+        return false;
+    }
+
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < RAM_CAPACITY; ++i) {
+        total += profile->addresses[i];
+    }
+
+    const double share = total ? 100.0 / total : 0;
+
+    fprintf(file, "# Profile of %s\n\n", rom_file);
+    fprintf(file, "instructions %llu, frames %llu, instructions per frame min %llu mean %.1f max %llu\n\n",
+        (unsigned long long)total, (unsigned long long)profile->frames,
+        (unsigned long long)(profile->frames ? profile->frame_min : 0),
+        profile->frames ? (double)total / profile->frames : 0,
+        (unsigned long long)profile->frame_max);
+
+    // Phases
+    uint64_t phase_total = 0;
+
+    for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        phase_total += profile->phase_ns[i];
+    }
+
+    fprintf(file, "phase\tseconds\tshare\n");
+
+    for (int i = 0; i < PROFILE_PHASE_COUNT; ++i) {
+        fprintf(file, "%s\t%.3f\t%.1f%%\n", g_phase_names[i], profile->phase_ns[i] / 1e9,
+            phase_total ? 100.0 * profile->phase_ns[i] / phase_total : 0);
+    }
+
+    // Opcode classes, chip8_opcode_name returns one string per class
+    ProfileEntry classes[64];
+    size_t class_count = 0;
+
+    for (uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+        if (!profile->opcodes[opcode]) {
+            continue;
+        }
+
+        const char* name = chip8_opcode_name(opcode);
+        size_t i = 0;
+
+        while (i < class_count && classes[i].name != name) {
+            ++i;
+        }
+
+        if (i == class_count) {
+            classes[class_count++] = (ProfileEntry){ name, 0, 0 };
+        }
+
+        classes[i].count += profile->opcodes[opcode];
+    }
+
+    qsort(classes, class_count, sizeof(ProfileEntry), profile_compare);
+
+    fprintf(file, "\nopcode\tcount\tshare\n");
+
+    for (size_t i = 0; i < class_count; ++i) {
+        fprintf(file, "%s\t%llu\t%.2f%%\n", classes[i].name,
+            (unsigned long long)classes[i].count, classes[i].count * share);
+    }
+
+    // Hot spots
+    static ProfileEntry addresses[RAM_CAPACITY];
+
+    for (uint32_t i = 0; i < RAM_CAPACITY; ++i) {
+        addresses[i] = (ProfileEntry){ NULL, i, profile->addresses[i] };
+    }
+
+    qsort(addresses, RAM_CAPACITY, sizeof(ProfileEntry), profile_compare);
+
+    fprintf(file, "\naddress\tcount\tshare\topcode\tinstruction\n");
+
+    for (uint32_t i = 0; i < PROFILE_HOT_SPOTS && addresses[i].count; ++i) {
+        const uint16_t opcode = profile->opcodes_at[addresses[i].address];
+        char text[32];
+        chip8_disassemble(opcode, text, sizeof(text));
+
+        fprintf(file, "0x%03X\t%llu\t%.2f%%\t%04X\t%s\n", addresses[i].address,
+            (unsigned long long)addresses[i].count, addresses[i].count * share, opcode, text);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+static bool profile_write_stacks(const Profile* profile, const Chip8* chip8, const char* path)
+{
+    // Collapsed stacks, "main;sub_2A0;sub_31C count" per line, as read by
+    //  flamegraph.pl and speedscope
+    FILE* file = fopen(path, "w");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open profile file \"%s\"\n", path);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < PROFILE_MAX_STACKS; ++i) {
+        const ProfileStack* stack = &profile->stacks[i];
+
+        if (!stack->count) {
+            continue;
+        }
+
+        fprintf(file, "main");
+
+        for (uint8_t depth = 0; depth < stack->depth; ++depth) {
+            profile_write_frame(file, chip8, stack->returns[depth]);
+        }
+
+        fprintf(file, " %llu\n", (unsigned long long)stack->count);
+    }
+
+    if (profile->lost_stacks) {
+        fprintf(file, "main;[unknown] %llu\n", (unsigned long long)profile->lost_stacks);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+bool profile_write(const Profile* profile, const Chip8* chip8, const char* rom_file)
+{
+    // Written next to the ROM, like quick saves
+    char report[4096];
+    char stacks[4096];
+    snprintf(report, sizeof(report), "%s.profile", rom_file);
+    snprintf(stacks, sizeof(stacks), "%s.folded", rom_file);
+
+    if (!profile_write_report(profile, rom_file, report) ||
+        !profile_write_stacks(profile, chip8, stacks)) {
+        return false;
+    }
+
+    printf("INFO: Wrote profile to \"%s\" and \"%s\"\n", report, stacks);
+
+    return true;
+}
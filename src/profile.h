@@ -0,0 +1,107 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "chip.h"
+
+// Execution profiler, built with -DPROFILE (make profile). Without PROFILE
+//  every hook below expands to nothing and the core is unchanged.
+
+#ifdef PROFILE
+
+#define PROFILE_MAX_STACKS 4096  // Distinct call stacks counted
+#define PROFILE_STACK_PROBES 64  // Hash table slots tried per lookup
+#define PROFILE_HOT_SPOTS 32     // Addresses listed in the report
+
+// Parts of a main loop iteration timed separately
+typedef enum ProfilePhase
+{
+    PROFILE_EVENTS = 0,
+    PROFILE_EXECUTE,
+    PROFILE_RENDER,
+    PROFILE_TIMERS,
+    PROFILE_PHASE_COUNT
+} ProfilePhase;
+
+typedef struct ProfileStack
+{
+    uint64_t count;      // Instructions executed with this call stack, 0 if unused
+    uint8_t depth;
+    uint16_t returns[12]; // Return addresses, outermost first
+} ProfileStack;
+
+struct Profile
+{
+    uint64_t addresses[RAM_CAPACITY];  // Executions per PC
+    uint16_t opcodes_at[RAM_CAPACITY]; // Last opcode executed at each PC
+    uint64_t opcodes[0x10000];         // Executions per opcode
+
+    ProfileStack stacks[PROFILE_MAX_STACKS]; // Open addressing on the return addresses
+    uint64_t lost_stacks;                     // Instructions whose stack did not fit
+
+    uint64_t phase_ns[PROFILE_PHASE_COUNT];
+
+    // Instructions per main loop iteration
+    uint64_t last_instructions;
+    uint64_t frames;
+    uint64_t frame_min;
+    uint64_t frame_max;
+};
+
+Profile* profile_create(void);
+void profile_destroy(Profile* profile);
+void profile_instruction(Profile* profile, const Chip8* chip8, uint16_t pc, uint16_t opcode);
+void profile_frame(Profile* profile, uint64_t total);
+uint64_t profile_now(void);
+void profile_add_time(Profile* profile, ProfilePhase phase, uint64_t start);
+bool profile_write(const Profile* profile, const Chip8* chip8, const char* rom_file);
+
+#define PROFILE_START(chip8) ((chip8)->profile = profile_create())
+
+#define PROFILE_FINISH(chip8, rom_file) \
+    do { \
+        if ((chip8)->profile) { \
+            profile_write((chip8)->profile, (chip8), (rom_file)); \
+            profile_destroy((chip8)->profile); \
+            (chip8)->profile = NULL; \
+        } \
+    } while (0)
+
+#define PROFILE_INSTRUCTION(chip8, pc, opcode) \
+    do { \
+        if ((chip8)->profile) { \
+            profile_instruction((chip8)->profile, (chip8), (pc), (opcode)); \
+        } \
+    } while (0)
+
+#define PROFILE_FRAME(chip8, total) \
+    do { \
+        if ((chip8)->profile) { \
+            profile_frame((chip8)->profile, (total)); \
+        } \
+    } while (0)
+
+// BEGIN and END of a phase must be in the same scope
+#define PROFILE_BEGIN(phase) const uint64_t profile_start_##phase = profile_now()
+
+#define PROFILE_END(chip8, phase) \
+    do { \
+        if ((chip8)->profile) { \
+            profile_add_time((chip8)->profile, (phase), profile_start_##phase); \
+        } \
+    } while (0)
+
+#else
+
+#define PROFILE_START(chip8)
+#define PROFILE_FINISH(chip8, rom_file)
+#define PROFILE_INSTRUCTION(chip8, pc, opcode)
+#define PROFILE_FRAME(chip8, total)
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(chip8, phase)
+
+#endif // PROFILE
+
+#endif // _PROFILE_H_
@@ -0,0 +1,269 @@
+#include "rewind.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames are save states stored as run-length encoded XOR deltas against
+//  the previous frame. XOR works in both directions, so the newest state
+//  steps back by applying the newest delta. Keyframes every
+//  REWIND_KEYFRAME_INTERVAL frames bound the deltas applied by a long seek.
+//
+// Encoding: pairs of LEB128 varints (unchanged bytes, changed bytes), each
+//  followed by the changed bytes themselves.
+
+static size_t rewind_put_varint(uint8_t* out, size_t value)
+{
+    size_t length = 0;
+
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    out[length++] = value;
+    return length;
+}
+
+static const uint8_t* rewind_get_varint(const uint8_t* in, size_t* value)
+{
+    *value = 0;
+
+    for (uint8_t shift = 0;; shift += 7) {
+        const uint8_t byte = *in++;
+        *value |= (size_t)(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            return in;
+        }
+    }
+}
+
+static bool rewind_zero_word(const uint8_t* data)
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word == 0;
+}
+
+static size_t rewind_encode(const uint8_t* data, size_t size, uint8_t* out)
+{
+    size_t length = 0;
+    size_t i = 0;
+
+    while (i < size) {
+        // Deltas are mostly zeros, skip them 8 bytes at a time
+        const size_t skip_start = i;
+        while (i + 8 <= size && rewind_zero_word(&data[i])) {
+            i += 8;
+        }
+
+        while (i < size && data[i] == 0) {
+            ++i;
+        }
+
+        if (i == size) {
+            break; // Trailing zeros are implied
+        }
+
+        const size_t literal_start = i;
+        while (i < size && data[i] != 0) {
+            ++i;
+        }
+
+        length += rewind_put_varint(&out[length], literal_start - skip_start);
+        length += rewind_put_varint(&out[length], i - literal_start);
+        memcpy(&out[length], &data[literal_start], i - literal_start);
+        length += i - literal_start;
+    }
+
+    return length;
+}
+
+static void rewind_apply(const uint8_t* in, size_t length, uint8_t* state)
+{
+    // XOR encoded data into state
+    const uint8_t* end = in + length;
+    size_t position = 0;
+
+    while (in < end) {
+        size_t skip;
+        size_t literal;
+        in = rewind_get_varint(in, &skip);
+        in = rewind_get_varint(in, &literal);
+        position += skip;
+
+        for (size_t i = 0; i < literal; ++i) {
+            state[position++] ^= *in++;
+        }
+    }
+}
+
+static RewindFrame* rewind_frame(Rewind* rewind, size_t index)
+{
+    // index 0 is the oldest frame
+    return &rewind->frames[(rewind->first + index) % REWIND_MAX_FRAMES];
+}
+
+static bool rewind_overlaps(const RewindFrame* frame, size_t start, size_t end)
+{
+    const size_t length = frame->delta_length + frame->key_length;
+    return frame->offset < end && frame->offset + length > start;
+}
+
+static void rewind_drop_oldest(Rewind* rewind)
+{
+    rewind->first = (rewind->first + 1) % REWIND_MAX_FRAMES;
+    rewind->count--;
+}
+
+static size_t rewind_reserve(Rewind* rewind, size_t length)
+{
+    // Drop the oldest frames until length bytes are free at the head,
+    //  a frame that does not fit before the end starts over at offset 0
+    size_t start = rewind->head;
+    const bool wrap = start + length > REWIND_BUFFER_SIZE;
+
+    while (rewind->count > 0) {
+        const RewindFrame* oldest = rewind_frame(rewind, 0);
+        const bool hit = wrap
+            ? rewind_overlaps(oldest, start, REWIND_BUFFER_SIZE) || rewind_overlaps(oldest, 0, length)
+            : rewind_overlaps(oldest, start, start + length);
+
+        if (!hit && rewind->count < REWIND_MAX_FRAMES) {
+            break;
+        }
+
+        rewind_drop_oldest(rewind);
+    }
+
+    if (wrap) {
+        start = 0;
+    }
+
+    rewind->head = start + length;
+    return start;
+}
+
+bool rewind_init(Rewind* rewind)
+{
+    rewind->buffer = malloc(REWIND_BUFFER_SIZE);
+    rewind->frames = malloc(REWIND_MAX_FRAMES * sizeof(RewindFrame));
+
+    if (!rewind->buffer || !rewind->frames) {
+        fprintf(stderr, "ERROR: Could not allocate rewind buffer\n");
+        rewind_cleanup(rewind);
+        rewind->buffer = NULL;
+        rewind->frames = NULL;
+        return false;
+    }
+
+    rewind_clear(rewind);
+
+    return true;
+}
+
+void rewind_cleanup(const Rewind* rewind)
+{
+    free(rewind->buffer);
+    free(rewind->frames);
+}
+
+void rewind_clear(Rewind* rewind)
+{
+    rewind->head = 0;
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->since_keyframe = 0;
+    rewind->state_size = 0;
+    memset(rewind->state, 0, sizeof(rewind->state));
+}
+
+void rewind_push(Rewind* rewind, const Chip8* chip8)
+{
+    // Record the state at the end of an emulated frame. States are as
+    //  long as the RAM in use, only the longer of the two is compared
+    const size_t size = chip8_save_state(chip8, rewind->scratch, sizeof(rewind->scratch));
+    const size_t compared = size > rewind->state_size ? size : rewind->state_size;
+    const size_t words = (compared + 7) / 8 * 8;
+
+    memset(&rewind->scratch[size], 0, words - size);
+
+    // XOR 8 bytes at a time, the buffers leave room past the largest state
+    for (size_t i = 0; i < words; i += 8) {
+        uint64_t next;
+        uint64_t delta;
+        memcpy(&next, &rewind->scratch[i], 8);
+        memcpy(&delta, &rewind->state[i], 8);
+        delta ^= next;
+        memcpy(&rewind->scratch[i], &delta, 8);
+        memcpy(&rewind->state[i], &next, 8);
+    }
+
+    rewind->state_size = size;
+
+    const size_t length = rewind_encode(rewind->scratch, compared, rewind->encoded);
+    size_t key_length = 0;
+
+    if (++rewind->since_keyframe >= REWIND_KEYFRAME_INTERVAL) {
+        key_length = rewind_encode(rewind->state, size, &rewind->encoded[length]);
+        rewind->since_keyframe = 0;
+    }
+
+    const size_t offset = rewind_reserve(rewind, length + key_length);
+    memcpy(&rewind->buffer[offset], rewind->encoded, length + key_length);
+
+    RewindFrame* frame = &rewind->frames[(rewind->first + rewind->count) % REWIND_MAX_FRAMES];
+    frame->offset = offset;
+    frame->delta_length = length;
+    frame->key_length = key_length;
+    frame->state_size = size;
+    rewind->count++;
+}
+
+const uint8_t* rewind_seek(Rewind* rewind, uint32_t frames)
+{
+    // Go back frames frames, returns the state to load or NULL once
+    //  the oldest recorded frame is reached
+    if (frames == 0 || frames >= rewind->count) {
+        return NULL;
+    }
+
+    const size_t newest = rewind->count - 1;
+    const size_t target = newest - frames;
+
+    // Start from the first keyframe after the target if it is closer
+    size_t from = newest;
+
+    for (size_t i = target; i < newest; ++i) {
+        const RewindFrame* frame = rewind_frame(rewind, i);
+
+        if (frame->key_length) {
+            memset(rewind->state, 0, rewind->state_size > frame->state_size
+                ? rewind->state_size : frame->state_size);
+            rewind_apply(&rewind->buffer[frame->offset + frame->delta_length],
+                frame->key_length, rewind->state);
+            from = i;
+            break;
+        }
+    }
+
+    // Undo deltas back to the target
+    for (size_t i = from; i > target; --i) {
+        const RewindFrame* frame = rewind_frame(rewind, i);
+        rewind_apply(&rewind->buffer[frame->offset], frame->delta_length, rewind->state);
+    }
+
+    rewind->state_size = rewind_frame(rewind, target)->state_size;
+
+    // Newer frames are gone, recording continues from the target
+    rewind->head = rewind_frame(rewind, target + 1)->offset;
+    rewind->count = target + 1;
+
+    rewind->since_keyframe = 0;
+    for (size_t i = target; i > 0 && !rewind_frame(rewind, i)->key_length; --i) {
+        rewind->since_keyframe++;
+    }
+
+    return rewind->state;
+}
@@ -0,0 +1,45 @@
+#ifndef _REWIND_H_
+#define _REWIND_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip.h"
+
+#define REWIND_BUFFER_SIZE (4 * 1024 * 1024) // Encoded frame data
+#define REWIND_MAX_FRAMES (5 * 60 * CHIP_TIMER_FREQUENCY) // 5 minutes of history
+#define REWIND_KEYFRAME_INTERVAL (5 * CHIP_TIMER_FREQUENCY) // Frames between full states
+#define REWIND_MAX_ENCODED (CHIP8_STATE_SIZE * 4) // Delta plus keyframe, each at most 1.5x
+
+typedef struct RewindFrame
+{
+    uint32_t offset;       // Start of the frame's data in the buffer
+    uint32_t delta_length; // Encoded XOR against the previous frame's state
+    uint32_t key_length;   // Encoded full state after the delta, 0 if none
+    uint32_t state_size;   // Bytes of the frame's state, zeros follow in Rewind.state
+} RewindFrame;
+
+typedef struct Rewind
+{
+    uint8_t* buffer;       // Ring of encoded frame data
+    size_t head;           // Offset the next frame is written at
+
+    RewindFrame* frames;   // Ring of recorded frames, oldest at first
+    size_t first;
+    size_t count;
+
+    uint32_t since_keyframe;
+    size_t state_size;                     // Bytes in use of state, the rest is zeros
+    uint8_t state[CHIP8_STATE_SIZE + 8];   // State of the newest frame
+    uint8_t scratch[CHIP8_STATE_SIZE + 8]; // Next state and XOR delta, 8 byte words
+    uint8_t encoded[REWIND_MAX_ENCODED];
+} Rewind;
+
+bool rewind_init(Rewind* rewind);
+void rewind_cleanup(const Rewind* rewind);
+void rewind_clear(Rewind* rewind);
+void rewind_push(Rewind* rewind, const Chip8* chip8);
+const uint8_t* rewind_seek(Rewind* rewind, uint32_t frames);
+
+#endif // _REWIND_H_
@@ -0,0 +1,421 @@
+#define _DEFAULT_SOURCE // mmap, strnlen
+
+#include "romdb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "chip.h"
+
+// File layout, little endian:
+//  "C8DB", version u16, entry size u16, entry count u32, then the entries
+//  sorted by hash: SHA-1 of the ROM image (20 bytes), platform u8, quirks
+//  u8, instructions per second u16, palette 4 * u32, name padded with
+//  zeros to ROMDB_NAME_SIZE bytes
+
+#define ROMDB_HEADER_SIZE (4 + 2 + 2 + 4)
+#define ROMDB_ENTRY_SIZE (ROMDB_HASH_SIZE + 1 + 1 + 2 + 4 * 4 + ROMDB_NAME_SIZE)
+
+typedef struct PlatformDefaults
+{
+    const char* name;
+    uint8_t quirks;
+    uint16_t ips;
+} PlatformDefaults;
+
+// Settings of entries that only give a platform, and of unknown ROMs
+static const PlatformDefaults g_platforms[PLATFORM_COUNT] = {
+    { "chip8", QUIRKS_CHIP8, CHIP_INST_PER_SECOND },
+    { "schip", QUIRKS_SCHIP, 1800 },   // 30 instructions per frame
+    { "xochip", QUIRKS_XOCHIP, 12000 } // 200 instructions per frame
+};
+
+static uint8_t* romdb_put(uint8_t* out, uint64_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; ++i) {
+        out[i] = (value >> (i * 8)) & 0xFF;
+    }
+
+    return out + bytes;
+}
+
+static const uint8_t* romdb_get(const uint8_t* in, uint64_t* value, uint8_t bytes)
+{
+    *value = 0;
+
+    for (uint8_t i = 0; i < bytes; ++i) {
+        *value |= (uint64_t)in[i] << (i * 8);
+    }
+
+    return in + bytes;
+}
+
+bool romdb_platform_from_name(const char* name, RomPlatform* platform)
+{
+    for (int i = 0; i < PLATFORM_COUNT; ++i) {
+        if (strcmp(g_platforms[i].name, name) == 0) {
+            *platform = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* romdb_platform_name(RomPlatform platform)
+{
+    return platform < PLATFORM_COUNT ? g_platforms[platform].name : "unknown";
+}
+
+void romdb_default_profile(RomPlatform platform, RomProfile* profile)
+{
+    memset(profile, 0, sizeof(RomProfile));
+    profile->platform = platform;
+    profile->quirks = g_platforms[platform].quirks;
+    profile->ips = g_platforms[platform].ips;
+    profile->palette[0] = BACKGROUND_COLOR;
+    profile->palette[1] = FOREGROUND_COLOR;
+    profile->palette[2] = PLANE2_COLOR;
+    profile->palette[3] = OVERLAP_COLOR;
+}
+
+bool romdb_open(RomDb* db, const char* path)
+{
+    memset(db, 0, sizeof(RomDb));
+
+#ifdef _WIN32
+    // No mmap, read the whole file instead
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+
+    uint8_t* data = malloc(size > 0 ? size : 1);
+
+    if (size <= 0 || fread(data, size, 1, file) != 1) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+
+    if (!data) {
+        fprintf(stderr, "ERROR: Could not read ROM database \"%s\"\n", path);
+        return false;
+    }
+#else
+    const int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    void* data = MAP_FAILED;
+
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    // The mapping stays valid after closing
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Could not map ROM database \"%s\"\n", path);
+        return false;
+    }
+
+    const size_t size = info.st_size;
+#endif
+
+    db->data = data;
+    db->size = size;
+
+    uint64_t version;
+    uint64_t entry_size;
+    uint64_t count;
+
+    if (db->size < ROMDB_HEADER_SIZE || memcmp(db->data, "C8DB", 4) != 0) {
+        fprintf(stderr, "ERROR: \"%s\" is not a ROM database\n", path);
+        romdb_close(db);
+        return false;
+    }
+
+    const uint8_t* in = romdb_get(db->data + 4, &version, 2);
+    in = romdb_get(in, &entry_size, 2);
+    romdb_get(in, &count, 4);
+
+    if (version != ROMDB_VERSION || entry_size != ROMDB_ENTRY_SIZE) {
+        fprintf(stderr, "ERROR: Unsupported ROM database version %u\n", (unsigned)version);
+        romdb_close(db);
+        return false;
+    }
+
+    if (count > (db->size - ROMDB_HEADER_SIZE) / ROMDB_ENTRY_SIZE) {
+        fprintf(stderr, "ERROR: ROM database \"%s\" is truncated\n", path);
+        romdb_close(db);
+        return false;
+    }
+
+    db->count = count;
+
+    return true;
+}
+
+void romdb_close(const RomDb* db)
+{
+    if (!db->data) {
+        return;
+    }
+
+#ifdef _WIN32
+    free((void*)db->data);
+#else
+    munmap((void*)db->data, db->size);
+#endif
+}
+
+bool romdb_find(const RomDb* db, const uint8_t hash[ROMDB_HASH_SIZE], RomProfile* profile)
+{
+    // Binary search in the mapping, only the pages on the path are read
+    if (db->count == 0) {
+        return false;
+    }
+
+    const uint8_t* entries = db->data + ROMDB_HEADER_SIZE;
+    uint32_t low = 0;
+    uint32_t high = db->count;
+
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        const uint8_t* entry = entries + (size_t)middle * ROMDB_ENTRY_SIZE;
+        const int order = memcmp(entry, hash, ROMDB_HASH_SIZE);
+
+        if (order < 0) {
+            low = middle + 1;
+        } else if (order > 0) {
+            high = middle;
+        } else {
+            uint64_t value;
+            const uint8_t* in = entry + ROMDB_HASH_SIZE;
+            const uint8_t platform = *in++;
+
+            romdb_default_profile(platform < PLATFORM_COUNT ? platform : PLATFORM_CHIP8, profile);
+            profile->quirks = *in++;
+            in = romdb_get(in, &value, 2);
+            profile->ips = value;
+
+            for (int i = 0; i < 4; ++i) {
+                in = romdb_get(in, &value, 4);
+                profile->palette[i] = value;
+            }
+
+            memcpy(profile->name, in, ROMDB_NAME_SIZE - 1);
+            profile->name[ROMDB_NAME_SIZE - 1] = '\0';
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool romdb_lookup(const RomDb* db, const uint8_t hash[ROMDB_HASH_SIZE], RomProfile* profile)
+{
+    // ROMs that are not listed get the CHIP-8 defaults
+    if (romdb_find(db, hash, profile)) {
+        return true;
+    }
+
+    romdb_default_profile(PLATFORM_CHIP8, profile);
+    return false;
+}
+
+bool romdb_write(const char* path, const uint8_t (*hashes)[ROMDB_HASH_SIZE],
+    const RomProfile* profiles, uint32_t count)
+{
+    uint8_t* data = calloc(1, ROMDB_HEADER_SIZE + (size_t)count * ROMDB_ENTRY_SIZE);
+
+    if (!data) {
+        fprintf(stderr, "ERROR: Could not allocate ROM database\n");
+        return false;
+    }
+
+    memcpy(data, "C8DB", 4);
+    uint8_t* out = romdb_put(data + 4, ROMDB_VERSION, 2);
+    out = romdb_put(out, ROMDB_ENTRY_SIZE, 2);
+    out = romdb_put(out, count, 4);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const RomProfile* profile = &profiles[i];
+
+        memcpy(out, hashes[i], ROMDB_HASH_SIZE);
+        out += ROMDB_HASH_SIZE;
+        *out++ = profile->platform;
+        *out++ = profile->quirks;
+        out = romdb_put(out, profile->ips, 2);
+
+        for (int j = 0; j < 4; ++j) {
+            out = romdb_put(out, profile->palette[j], 4);
+        }
+
+        // Zero padded, calloc cleared the rest
+        memcpy(out, profile->name, strnlen(profile->name, ROMDB_NAME_SIZE - 1));
+        out += ROMDB_NAME_SIZE;
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open ROM database \"%s\"\n", path);
+        free(data);
+        return false;
+    }
+
+    const bool ok = fwrite(data, out - data, 1, file) == 1;
+    fclose(file);
+    free(data);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not write ROM database \"%s\"\n", path);
+    }
+
+    return ok;
+}
+
+static uint32_t romdb_rotate(uint32_t value, uint8_t bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void romdb_sha1_block(uint32_t state[5], const uint8_t block[64])
+{
+    uint32_t w[80];
+
+    for (int i = 0; i < 16; ++i) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | (block[i * 4 + 1] << 16) |
+            (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+
+    for (int i = 16; i < 80; ++i) {
+        w[i] = romdb_rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f;
+        uint32_t k;
+
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        const uint32_t temp = romdb_rotate(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = romdb_rotate(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void romdb_hash(const uint8_t* data, size_t size, uint8_t hash[ROMDB_HASH_SIZE])
+{
+    // SHA-1, the hash most ROM archives list their files by
+    uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t offset = 0;
+
+    for (; size - offset >= 64; offset += 64) {
+        romdb_sha1_block(state, data + offset);
+    }
+
+    // Pad with 0x80, zeros and the length in bits, big endian
+    uint8_t tail[128] = { 0 };
+    const size_t rest = size - offset;
+    const size_t tail_size = rest < 56 ? 64 : 128;
+    const uint64_t bits = (uint64_t)size * 8;
+
+    memcpy(tail, data + offset, rest);
+    tail[rest] = 0x80;
+
+    for (int i = 0; i < 8; ++i) {
+        tail[tail_size - 1 - i] = (bits >> (i * 8)) & 0xFF;
+    }
+
+    for (size_t block = 0; block < tail_size; block += 64) {
+        romdb_sha1_block(state, tail + block);
+    }
+
+    for (int i = 0; i < 5; ++i) {
+        hash[i * 4] = state[i] >> 24;
+        hash[i * 4 + 1] = (state[i] >> 16) & 0xFF;
+        hash[i * 4 + 2] = (state[i] >> 8) & 0xFF;
+        hash[i * 4 + 3] = state[i] & 0xFF;
+    }
+}
+
+bool romdb_hash_file(const char* path, uint8_t hash[ROMDB_HASH_SIZE])
+{
+    // Anything larger than RAM is not a loadable ROM, chip8_init rejects it
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        return false;
+    }
+
+    uint8_t* data = malloc(RAM_CAPACITY);
+
+    if (!data) {
+        fclose(file);
+        return false;
+    }
+
+    const size_t size = fread(data, 1, RAM_CAPACITY, file);
+    fclose(file);
+
+    romdb_hash(data, size, hash);
+    free(data);
+
+    return true;
+}
+
+void romdb_format_hash(const uint8_t hash[ROMDB_HASH_SIZE], char text[ROMDB_HASH_SIZE * 2 + 1])
+{
+    for (int i = 0; i < ROMDB_HASH_SIZE; ++i) {
+        snprintf(&text[i * 2], 3, "%02x", hash[i]);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef _ROMDB_H_
+#define _ROMDB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Per-ROM settings looked up by the SHA-1 of the ROM image in a database
+//  compiled by chip8db, see data/chip8db.txt. The file is mapped and
+//  searched in place, opening it costs nothing however large it grows
+
+#define ROMDB_VERSION 1
+#define ROMDB_HASH_SIZE 20    // SHA-1 digest
+#define ROMDB_NAME_SIZE 64    // Longest name kept, including the terminator
+#define ROMDB_FILE "chip8.db" // Looked up next to the executable
+
+typedef enum RomPlatform
+{
+    PLATFORM_CHIP8 = 0,
+    PLATFORM_SCHIP,
+    PLATFORM_XOCHIP,
+    PLATFORM_COUNT
+} RomPlatform;
+
+// How a ROM wants to be run
+typedef struct RomProfile
+{
+    char name[ROMDB_NAME_SIZE];
+    uint8_t platform;   // RomPlatform
+    uint8_t quirks;     // Quirk flags, see Quirk in chip.h
+    uint16_t ips;       // Instructions per second
+    uint32_t palette[4]; // Colors by plane bits, 0xRRGGBBAA
+} RomProfile;
+
+typedef struct RomDb
+{
+    const uint8_t* data; // Whole file, mapped read only
+    size_t size;
+    uint32_t count;      // Entries, sorted by hash
+} RomDb;
+
+bool romdb_open(RomDb* db, const char* path);
+void romdb_close(const RomDb* db);
+bool romdb_find(const RomDb* db, const uint8_t hash[ROMDB_HASH_SIZE], RomProfile* profile);
+bool romdb_lookup(const RomDb* db, const uint8_t hash[ROMDB_HASH_SIZE], RomProfile* profile);
+
+void romdb_default_profile(RomPlatform platform, RomProfile* profile);
+bool romdb_platform_from_name(const char* name, RomPlatform* platform);
+const char* romdb_platform_name(RomPlatform platform);
+
+void romdb_hash(const uint8_t* data, size_t size, uint8_t hash[ROMDB_HASH_SIZE]);
+bool romdb_hash_file(const char* path, uint8_t hash[ROMDB_HASH_SIZE]);
+void romdb_format_hash(const uint8_t hash[ROMDB_HASH_SIZE], char text[ROMDB_HASH_SIZE * 2 + 1]);
+
+// Writes a database, entries must be sorted by hash
+bool romdb_write(const char* path, const uint8_t (*hashes)[ROMDB_HASH_SIZE],
+    const RomProfile* profiles, uint32_t count);
+
+#endif // _ROMDB_H_
@@ -0,0 +1,322 @@
+#define _DEFAULT_SOURCE // strtok_r
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "chip.h"
+#include "romdb.h"
+#include "library.h"
+
+// chip8db: compiles the text ROM list into the database read by the
+//  emulator, prints entries for new ROMs and packs ROM archives
+//
+// Usage: chip8db build <list file> <database>
+//        chip8db hash <rom file>...
+//        chip8db find <database> <rom file>...
+//        chip8db pack <archive> <directory or rom file>...
+//
+// List lines, # starts a comment:
+//  <sha1> <platform> [ips=<n>] [quirks=<profile or flags>]
+//      [colors=<background>,<plane 1>,<plane 2>,<both>] [<name>]
+//  platform is chip8, schip or xochip and chooses the defaults of the
+//  fields left out, colors are RRGGBB
+
+typedef struct ListEntry
+{
+    uint8_t hash[ROMDB_HASH_SIZE];
+    RomProfile profile;
+} ListEntry;
+
+static bool parse_hash(const char* text, uint8_t hash[ROMDB_HASH_SIZE])
+{
+    if (strlen(text) != ROMDB_HASH_SIZE * 2) {
+        return false;
+    }
+
+    for (int i = 0; i < ROMDB_HASH_SIZE; ++i) {
+        char byte[3] = { text[i * 2], text[i * 2 + 1], '\0' };
+        char* end;
+        hash[i] = strtoul(byte, &end, 16);
+
+        if (*end != '\0') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool parse_colors(char* text, uint32_t palette[4])
+{
+    for (int i = 0; i < 4; ++i) {
+        char* end;
+        const unsigned long color = strtoul(text, &end, 16);
+
+        if (end - text != 6 || (i < 3 ? *end != ',' : *end != '\0')) {
+            return false;
+        }
+
+        palette[i] = (color << 8) | 0xFF;
+        text = end + 1;
+    }
+
+    return true;
+}
+
+static bool parse_line(char* line, ListEntry* entry)
+{
+    char* save;
+    const char* hash = strtok_r(line, " \t", &save);
+    const char* platform_name = strtok_r(NULL, " \t", &save);
+    RomPlatform platform;
+
+    if (!hash || !platform_name || !parse_hash(hash, entry->hash) ||
+        !romdb_platform_from_name(platform_name, &platform)) {
+        return false;
+    }
+
+    romdb_default_profile(platform, &entry->profile);
+
+    for (char* field; (field = strtok_r(NULL, " \t", &save));) {
+        char* end;
+
+        if (strncmp(field, "ips=", 4) == 0) {
+            const unsigned long ips = strtoul(field + 4, &end, 10);
+
+            if (*end != '\0' || ips < CHIP_MIN_INST_PER_SECOND || ips > CHIP_MAX_INST_PER_SECOND) {
+                return false;
+            }
+
+            entry->profile.ips = ips;
+        } else if (strncmp(field, "quirks=", 7) == 0) {
+            if (!chip8_quirks_from_name(field + 7, &entry->profile.quirks)) {
+                const unsigned long quirks = strtoul(field + 7, &end, 0);
+
+                if (*end != '\0' || quirks > 0xFF) {
+                    return false;
+                }
+
+                entry->profile.quirks = quirks;
+            }
+        } else if (strncmp(field, "colors=", 7) == 0) {
+            if (!parse_colors(field + 7, entry->profile.palette)) {
+                return false;
+            }
+        } else {
+            // The rest of the line, put back the separator strtok removed
+            if (*save) {
+                save[-1] = ' ';
+            }
+
+            snprintf(entry->profile.name, sizeof(entry->profile.name), "%s", field);
+            break;
+        }
+    }
+
+    return true;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    return memcmp(((const ListEntry*)a)->hash, ((const ListEntry*)b)->hash, ROMDB_HASH_SIZE);
+}
+
+static int build(const char* list_path, const char* db_path)
+{
+    FILE* list = fopen(list_path, "r");
+
+    if (!list) {
+        fprintf(stderr, "ERROR: Could not open ROM list \"%s\"\n", list_path);
+        return EXIT_FAILURE;
+    }
+
+    ListEntry* entries = NULL;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    uint32_t line_number = 0;
+    char line[1024];
+    bool ok = true;
+
+    while (fgets(line, sizeof(line), list)) {
+        ++line_number;
+
+        // Comments and trailing whitespace
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        size_t length = strlen(line);
+        while (length > 0 && strchr(" \t\r\n", line[length - 1])) {
+            line[--length] = '\0';
+        }
+
+        if (strspn(line, " \t") == length) {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            entries = realloc(entries, capacity * sizeof(ListEntry));
+        }
+
+        if (!parse_line(line, &entries[count])) {
+            fprintf(stderr, "ERROR: %s:%u: Malformed entry\n", list_path, line_number);
+            ok = false;
+            continue;
+        }
+
+        ++count;
+    }
+
+    fclose(list);
+
+    // Sorted for the binary search, a hash listed twice is a mistake
+    qsort(entries, count, sizeof(ListEntry), compare_entries);
+
+    for (uint32_t i = 1; i < count; ++i) {
+        if (compare_entries(&entries[i - 1], &entries[i]) == 0) {
+            char text[ROMDB_HASH_SIZE * 2 + 1];
+            romdb_format_hash(entries[i].hash, text);
+            fprintf(stderr, "ERROR: %s is listed more than once\n", text);
+            ok = false;
+        }
+    }
+
+    uint8_t (*hashes)[ROMDB_HASH_SIZE] = malloc((count ? count : 1) * sizeof(*hashes));
+    RomProfile* profiles = malloc((count ? count : 1) * sizeof(RomProfile));
+
+    for (uint32_t i = 0; i < count; ++i) {
+        memcpy(hashes[i], entries[i].hash, ROMDB_HASH_SIZE);
+        profiles[i] = entries[i].profile;
+    }
+
+    if (ok) {
+        ok = romdb_write(db_path, hashes, profiles, count);
+    }
+
+    if (ok) {
+        printf("INFO: Wrote %u ROMs to \"%s\"\n", count, db_path);
+    }
+
+    free(profiles);
+    free(hashes);
+    free(entries);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int hash(int count, char** roms)
+{
+    // One list line per ROM with the CHIP-8 defaults, to be edited
+    for (int i = 0; i < count; ++i) {
+        uint8_t digest[ROMDB_HASH_SIZE];
+        char text[ROMDB_HASH_SIZE * 2 + 1];
+
+        if (!romdb_hash_file(roms[i], digest)) {
+            fprintf(stderr, "ERROR: Could not read ROM file \"%s\"\n", roms[i]);
+            return EXIT_FAILURE;
+        }
+
+        romdb_format_hash(digest, text);
+        printf("%s chip8 %s\n", text, roms[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int find(const char* db_path, int count, char** roms)
+{
+    RomDb db;
+
+    if (!romdb_open(&db, db_path)) {
+        fprintf(stderr, "ERROR: Could not open ROM database \"%s\"\n", db_path);
+        return EXIT_FAILURE;
+    }
+
+    bool found_all = true;
+
+    for (int i = 0; i < count; ++i) {
+        uint8_t digest[ROMDB_HASH_SIZE];
+        RomProfile profile;
+
+        if (!romdb_hash_file(roms[i], digest)) {
+            fprintf(stderr, "ERROR: Could not read ROM file \"%s\"\n", roms[i]);
+            found_all = false;
+            continue;
+        }
+
+        if (!romdb_find(&db, digest, &profile)) {
+            printf("%s: not found\n", roms[i]);
+            found_all = false;
+            continue;
+        }
+
+        printf("%s: \"%s\" %s, %u IPS, quirks 0x%02X, colors %08X %08X %08X %08X\n",
+            roms[i], profile.name, romdb_platform_name(profile.platform), profile.ips,
+            profile.quirks, profile.palette[0], profile.palette[1], profile.palette[2],
+            profile.palette[3]);
+    }
+
+    romdb_close(&db);
+
+    return found_all ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int pack(const char* archive_path, int count, char** paths)
+{
+    // ROMs of directories in name order, then single files as given
+    Library library = { 0 };
+
+    for (int i = 0; i < count; ++i) {
+        struct stat info;
+        const bool directory = stat(paths[i], &info) == 0 && S_ISDIR(info.st_mode);
+
+        const bool added = directory ? library_add_directory(&library, paths[i]) :
+            library_add_file(&library, paths[i]);
+
+        if (!added) {
+            library_close(&library);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const bool ok = library_save(&library, archive_path);
+
+    if (ok) {
+        printf("INFO: Packed %u ROMs into \"%s\"\n", library.count, archive_path);
+    }
+
+    library_close(&library);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 4 && strcmp(argv[1], "build") == 0) {
+        return build(argv[2], argv[3]);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "hash") == 0) {
+        return hash(argc - 2, argv + 2);
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "find") == 0) {
+        return find(argv[2], argc - 3, argv + 3);
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "pack") == 0) {
+        return pack(argv[2], argc - 3, argv + 3);
+    }
+
+    fprintf(stderr,
+        "Usage: chip8db build <list file> <database>\n"
+        "       chip8db hash <rom file>...\n"
+        "       chip8db find <database> <rom file>...\n"
+        "       chip8db pack <archive> <directory or rom file>...\n");
+
+    return EXIT_FAILURE;
+}
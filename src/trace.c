@@ -0,0 +1,191 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// File layout, little endian:
+//  "C8TR", version u16, record size u16, step number of the first record
+//  u64, record count u32, then the records oldest first, fields in the
+//  order of TraceRecord. Loads of several registers are followed by the
+//  trace_loaded_range registers they wrote
+
+#define TRACE_HEADER_SIZE (4 + 2 + 2 + 8 + 4)
+#define TRACE_RECORD_SIZE 16
+
+static uint8_t* trace_put(uint8_t* out, uint64_t value, uint8_t bytes)
+{
+    for (uint8_t i = 0; i < bytes; ++i) {
+        out[i] = (value >> (i * 8)) & 0xFF;
+    }
+
+    return out + bytes;
+}
+
+static const uint8_t* trace_get(const uint8_t* in, uint64_t* value, uint8_t bytes)
+{
+    *value = 0;
+
+    for (uint8_t i = 0; i < bytes; ++i) {
+        *value |= (uint64_t)in[i] << (i * 8);
+    }
+
+    return in + bytes;
+}
+
+bool trace_init(Trace* trace)
+{
+    trace->records = malloc(TRACE_CAPACITY * sizeof(TraceRecord));
+    trace->steps = 0;
+    trace->trigger = TRACE_NO_TRIGGER;
+    trace->triggered = false;
+
+    if (!trace->records) {
+        fprintf(stderr, "ERROR: Could not allocate trace buffer\n");
+        return false;
+    }
+
+    return true;
+}
+
+void trace_cleanup(const Trace* trace)
+{
+    free(trace->records);
+}
+
+bool trace_save(const Trace* trace, const char* path)
+{
+    const uint32_t count = trace->steps < TRACE_CAPACITY ? trace->steps : TRACE_CAPACITY;
+    const uint64_t first = trace->steps - count;
+
+    uint8_t* data = malloc(TRACE_HEADER_SIZE + (size_t)count * (TRACE_RECORD_SIZE + 16));
+
+    if (!data) {
+        fprintf(stderr, "ERROR: Could not allocate trace file buffer\n");
+        return false;
+    }
+
+    memcpy(data, "C8TR", 4);
+    uint8_t* out = trace_put(data + 4, TRACE_VERSION, 2);
+    out = trace_put(out, TRACE_RECORD_SIZE, 2);
+    out = trace_put(out, first, 8);
+    out = trace_put(out, count, 4);
+
+    for (uint64_t step = first; step < trace->steps; ++step) {
+        const TraceRecord* record = &trace->records[step & (TRACE_CAPACITY - 1)];
+        out = trace_put(out, record->pc, 2);
+        out = trace_put(out, record->opcode, 2);
+        out = trace_put(out, record->I, 2);
+        out = trace_put(out, record->new_I, 2);
+        *out++ = record->vx;
+        *out++ = record->vy;
+        *out++ = record->v0;
+        *out++ = record->vf;
+        *out++ = record->new_vx;
+        *out++ = record->new_vf;
+        *out++ = record->delay_timer;
+        *out++ = record->sound_timer;
+
+        uint8_t first;
+        const uint8_t loaded = trace_loaded_range(record->opcode, &first);
+        memcpy(out, record->loaded, loaded);
+        out += loaded;
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open trace file \"%s\"\n", path);
+        free(data);
+        return false;
+    }
+
+    // One large write, the file is the whole ring at the time of the dump
+    const bool ok = fwrite(data, out - data, 1, file) == 1;
+    fclose(file);
+    free(data);
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not write trace file \"%s\"\n", path);
+    }
+
+    return ok;
+}
+
+bool trace_load(Trace* trace, const char* path, uint64_t* first_step, uint32_t* count)
+{
+    // Fills trace->records from index 0, allocated with trace_init
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open trace file \"%s\"\n", path);
+        return false;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    uint64_t version;
+    uint64_t record_size;
+    uint64_t records;
+
+    if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, "C8TR", 4) != 0) {
+        fprintf(stderr, "ERROR: \"%s\" is not a CHIP-8 trace\n", path);
+        fclose(file);
+        return false;
+    }
+
+    const uint8_t* in = trace_get(header + 4, &version, 2);
+    in = trace_get(in, &record_size, 2);
+    in = trace_get(in, first_step, 8);
+    trace_get(in, &records, 4);
+
+    if (version != TRACE_VERSION || record_size != TRACE_RECORD_SIZE || records > TRACE_CAPACITY) {
+        fprintf(stderr, "ERROR: Unsupported trace version %u\n", (unsigned)version);
+        fclose(file);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < records; ++i) {
+        uint8_t data[TRACE_RECORD_SIZE];
+
+        if (fread(data, sizeof(data), 1, file) != 1) {
+            fprintf(stderr, "ERROR: Trace \"%s\" is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+
+        TraceRecord* record = &trace->records[i];
+        uint64_t value;
+        in = trace_get(data, &value, 2);
+        record->pc = value;
+        in = trace_get(in, &value, 2);
+        record->opcode = value;
+        in = trace_get(in, &value, 2);
+        record->I = value;
+        in = trace_get(in, &value, 2);
+        record->new_I = value;
+        record->vx = *in++;
+        record->vy = *in++;
+        record->v0 = *in++;
+        record->vf = *in++;
+        record->new_vx = *in++;
+        record->new_vf = *in++;
+        record->delay_timer = *in++;
+        record->sound_timer = *in;
+
+        uint8_t first;
+        const uint8_t loaded = trace_loaded_range(record->opcode, &first);
+
+        if (loaded > 0 && fread(record->loaded, loaded, 1, file) != 1) {
+            fprintf(stderr, "ERROR: Trace \"%s\" is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+    }
+
+    fclose(file);
+
+    trace->steps = records;
+    *count = records;
+
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "chip.h"
+
+// Execution trace of the last TRACE_CAPACITY interpreted instructions,
+//  recorded in DEBUG builds and decoded offline with chip8trace.
+
+#define TRACE_VERSION 2
+#define TRACE_CAPACITY (1 << 20) // Records kept, a power of two
+#define TRACE_NO_TRIGGER UINT32_MAX
+
+typedef struct TraceRecord
+{
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;          // I before the step
+    uint16_t new_I;      // I after the step
+    uint8_t vx;          // VX before the step
+    uint8_t vy;          // VY before the step
+    uint8_t v0;          // V0 before the step, BNNN jumps relative to it
+    uint8_t vf;          // VF before the step
+    uint8_t new_vx;      // VX after the step
+    uint8_t new_vf;      // VF after the step
+    uint8_t delay_timer; // Timers before the step
+    uint8_t sound_timer;
+    uint8_t loaded[16];  // Registers FX65, FX85 and 5XY3 wrote, lowest first
+} TraceRecord;
+
+typedef struct Trace
+{
+    TraceRecord* records; // Ring, step n is at n % TRACE_CAPACITY
+    uint64_t steps;       // Instructions recorded since the trace started
+    uint32_t trigger;     // PC that requests a dump, TRACE_NO_TRIGGER if none
+    bool triggered;       // The trigger PC executed since the last dump
+} Trace;
+
+bool trace_init(Trace* trace);
+void trace_cleanup(const Trace* trace);
+bool trace_save(const Trace* trace, const char* path);
+bool trace_load(Trace* trace, const char* path, uint64_t* first_step, uint32_t* count);
+
+static inline uint8_t trace_loaded_range(uint16_t opcode, uint8_t* first)
+{
+    // Number of registers a load writes and the lowest of them, 0 for
+    //  steps that write VX and VF at most
+    const uint8_t x = (opcode >> 8) & 0x0F;
+    const uint8_t y = (opcode >> 4) & 0x0F;
+
+    if ((opcode & 0xF0FF) == 0xF065 || (opcode & 0xF0FF) == 0xF085) {
+        *first = 0;
+        return x + 1;
+    }
+
+    if ((opcode & 0xF00F) == 0x5003) {
+        *first = x < y ? x : y;
+        return (x < y ? y - x : x - y) + 1;
+    }
+
+    return 0;
+}
+
+static inline TraceRecord* trace_begin(Trace* trace, const Chip8* chip8, uint16_t pc)
+{
+    // Fill the next slot with the state before the step, only scalars so
+    //  the interpreter does not stall on its own recent register writes
+    TraceRecord* record = &trace->records[trace->steps++ & (TRACE_CAPACITY - 1)];
+    record->pc = pc;
+    record->opcode = chip8->inst.opcode;
+    record->I = chip8->I;
+    record->vx = chip8->V[chip8->inst.X];
+    record->vy = chip8->V[chip8->inst.Y];
+    record->v0 = chip8->V[0];
+    record->vf = chip8->V[0xF];
+    record->delay_timer = chip8->delay_timer;
+    record->sound_timer = chip8->sound_timer;
+
+    if (pc == trace->trigger) {
+        trace->triggered = true;
+    }
+
+    return record;
+}
+
+static inline void trace_end(TraceRecord* record, const Chip8* chip8)
+{
+    record->new_I = chip8->I;
+    record->new_vx = chip8->V[chip8->inst.X];
+    record->new_vf = chip8->V[0xF];
+
+    uint8_t first;
+    const uint8_t count = trace_loaded_range(record->opcode, &first);
+
+    if (count > 0) {
+        memcpy(record->loaded, &chip8->V[first], count);
+    }
+}
+
+#ifdef DEBUG
+
+// BEGIN and END of a step must be in the same scope
+#define TRACE_BEGIN(chip8, pc) \
+    TraceRecord* trace_step = (chip8)->trace ? trace_begin((chip8)->trace, (chip8), (pc)) : NULL
+
+#define TRACE_END(chip8) \
+    do { \
+        if (trace_step) { \
+            trace_end(trace_step, (chip8)); \
+        } \
+    } while (0)
+
+#else
+
+#define TRACE_BEGIN(chip8, pc)
+#define TRACE_END(chip8)
+
+#endif // DEBUG
+
+#endif // _TRACE_H_
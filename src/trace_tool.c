@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// chip8trace: prints a trace dumped by a DEBUG build, one line per step
+//
+// Usage: chip8trace [--last <n>] <trace file>
+
+static void print_description(const TraceRecord* record)
+{
+    const uint8_t X = (record->opcode >> 8) & 0x0F;
+    const uint8_t Y = (record->opcode >> 4) & 0x0F;
+    const uint8_t N = record->opcode & 0x0F;
+    const uint8_t NN = record->opcode & 0xFF;
+    const uint16_t NNN = record->opcode & 0x0FFF;
+
+    switch (record->opcode >> 12) {
+    case 0x00:
+        switch (NN) {
+        case 0xE0:
+            // 0x00E0: Clear the screen
+            printf("Clear the screen");
+            break;
+
+        case 0xEE:
+            // 0x00EE: Return from a subroutine
+            // Pop last address from the stack
+            //  and set PC to it
+            printf("Return from subroutine");
+            break;
+
+        case 0xFB:
+            // 0x00FB: Scroll the selected planes right by 4 pixels
+            printf("Scroll right by 4 pixels");
+            break;
+
+        case 0xFC:
+            // 0x00FC: Scroll the selected planes left by 4 pixels
+            printf("Scroll left by 4 pixels");
+            break;
+
+        case 0xFD:
+            // 0x00FD: Exit the interpreter
+            printf("Exit");
+            break;
+
+        case 0xFE:
+        case 0xFF:
+            // 0x00FE / 0x00FF: Switch to lo-res / hi-res and clear the screen
+            printf("Switch to %s and clear the screen", NN == 0xFF ? "128x64 hi-res" : "64x32 lo-res");
+            break;
+
+        default:
+            if ((NN & 0xF0) == 0xC0 || (NN & 0xF0) == 0xD0) {
+                // 0x00CN / 0x00DN: Scroll the selected planes down / up by N rows
+                printf("Scroll %s by N (%u) rows", (NN & 0xF0) == 0xC0 ? "down" : "up", N);
+                break;
+            }
+
+            // Not implemented
+            //   or 0x0NNN: Calls machine code routine at address NNN
+            printf("Not implemented");
+            break;
+        }
+        break;
+
+    case 0x01:
+        // 0x1NNN: Jump to address NNN
+        printf("Jump to address NNN (0x%04X)", NNN);
+        break;
+
+    case 0x02:
+        // 0x2NNN: Call subroutine at NNN
+        // Push PC in the stack and set PC
+        //   to the jump address
+        printf("Call subroutine at NNN (0x%04X)", NNN);
+        break;
+
+    case 0x03:
+        // 0x3XNN: Skip the next instruction if VX equals NN
+        printf("Skip the next instruction if V%X (0x%02X) equals NN (0x%02X)",
+            X, record->vx, NN);
+        break;
+
+    case 0x04:
+        // 0x4XNN: Skip the next instruction if VX does not equal NN
+        printf("Skip the next instruction if V%X (0x%02X) does not equal NN (0x%02X)",
+            X, record->vx, NN);
+        break;
+
+    case 0x05:
+        if (N == 0x2 || N == 0x3) {
+            // 0x5XY2 / 0x5XY3: Store / load VX to VY at memory location I
+            printf("%s registers V%X to V%X %s memory location I (0x%04X)",
+                N == 0x2 ? "Dump" : "Load", X, Y, N == 0x2 ? "at" : "from", record->I);
+            break;
+        }
+
+        // 0x5XY0: Skip the next instruction if VX equals VY
+        printf("Skip the next instruction if V%X (0x%02X) equals V%X (0x%02X)",
+            X, record->vx,
+            Y, record->vy);
+        break;
+
+    case 0x06:
+        // 0x6XNN: Set VX to NN
+        printf("Set V%X to NN (0x%02X)", X, NN);
+        break;
+
+    case 0x07:
+        // 0x7XNN: Adds NN to VX (carry flag is not changed)
+        printf("Adds NN (0x%02X) to V%X (0x%02X)",
+            NN, X, record->vx);
+        break;
+
+    case 0x08:
+        switch (N) {
+        case 0x0:
+            // 0x8XY0: Set VX to the value of VY
+            printf("Set V%X (0x%02X) to the value of V%X (0x%02X)",
+                X, record->vx,
+                Y, record->vy);
+            break;
+
+        case 0x1:
+            // 0x8XY1: Set VX to VX or VY (bitwise)
+            printf("Set V%X (0x%02X) to V%X or V%X (0x%02X) (bitwise)",
+                X, record->vx, X,
+                Y, record->vy);
+            break;
+
+        case 0x2:
+            // 0x8XY2: Set VX to VX and VY (bitwise)
+            printf("Set V%X (0x%02X) to V%X and V%X (0x%02X) (bitwise)",
+                X, record->vx, X,
+                Y, record->vy);
+            break;
+
+        case 0x3:
+            // 0x8XY3: Set VX to VX xor VY
+            printf("Set V%X (0x%02X) to V%X xor V%X (0x%02X)",
+                X, record->vx, X,
+                Y, record->vy);
+            break;
+
+        case 0x4:
+            // 0x8XY4: Add VY to VX, set VF
+            printf("Add V%X (0x%02X) to V%X (0x%02X), set VF flag",
+                X, record->vx,
+                Y, record->vy);
+            break;
+
+        case 0x5:
+            // 0x8XY5: VY is subtracted from VX, set VF
+            printf("V%X (0x%02X) is subtracted from V%X (0x%02X), set VF flag",
+                Y, record->vy,
+                X, record->vx);
+            break;
+
+        case 0x6:
+            // 0x8XY6: Stores the least significant bit of VX in VF
+            //   and then shifts VX to the right by 1
+            printf("Shift V%X to the right by 1, set VF flag", X);
+            break;
+
+        case 0x7:
+            // 0x8XY7: Set VX to VY minus VX, set VF
+            printf("Set V%X to V%X (%02X) minus V%X (%02X), set VF",
+                X, Y, record->vy,
+                X, record->vx);
+            break;
+
+        case 0xE:
+            // 0x8XYE: Stores the most significant bit of VX in VF
+            //  and then shifts VX to the left by 1
+            printf("Shift V%X to the left by 1, set VF flag", X);
+            break;
+
+        default:
+            // Not implemented or bad opcode
+            printf("Not implemented or bad opcode");
+            break;
+        }
+        break;
+
+    case 0x09:
+        // 0x9XY0: Skip the next instruction if VX does not equal VY
+        printf("Skip the next instruction if V%X (%02X) does not equal V%X (%02X)",
+            X, record->vx,
+            Y, record->vy);
+        break;
+
+    case 0x0A:
+        // 0xANNN: Set I to the address NNN
+        printf("Set I to NNN (0x%04X)", NNN);
+        break;
+
+    case 0x0B:
+        // 0xBNNN: Jump to the address NNN plus V0
+        printf("Jump to the address NNN (0x%04X) plus V0 (0x%02X)", NNN, record->v0);
+        break;
+
+    case 0x0C:
+        // 0xCXNN: Set VX to the result of a bitwise and operation
+        //  on a random number and NN
+        printf("Set V%X to the result of a bitwise and "
+            "operation on a random number and NN (0x%02X)", X, NN);
+        break;
+
+    case 0x0D:
+        // 0xDXYN: Draw a sprite at coordinate (VX, VY)
+        //  Read from memory location I.
+        //  VF (Carry flag) is set if any screen pixels are set off
+        //  N is 0 for a 16x16 sprite
+        printf("Draw N (%u) height sprite at coords "
+            "V%X (0x%02X), V%X (0x%02X) from memory location I (0x%04X)",
+            N ? N : 16,
+            X, record->vx,
+            Y, record->vy, record->I);
+        break;
+
+    case 0x0E:
+        switch (NN) {
+        case 0x9E:
+            // 0xEX9E: Skip the next instruction if the key stored in VX is pressed
+            printf("Skip the next instruction if the key stored in V%X (0x%02X) is pressed",
+                X, record->vx);
+            break;
+
+        case 0xA1:
+            // 0xEXA1: Skips the next instruction if the key stored in VX is not pressed
+            printf("Skip the next instruction if the key stored in V%X (0x%02X) is not pressed",
+                X, record->vx);
+            break;
+
+        default:
+            printf("Not implemented or invalid opcode");
+            break; // Not implemented or invalid opcode
+        }
+        break;
+
+    case 0x0F:
+        switch (NN) {
+        case 0x00:
+            // 0xF000 NNNN: Set I to the 16 bit address in the next word
+            if (record->opcode == 0xF000) {
+                printf("Set I to the next word (0x%04X)", record->new_I);
+            } else {
+                printf("Not implemented or invalid opcode");
+            }
+            break;
+
+        case 0x01:
+            // 0xFN01: Select the planes drawn, cleared and scrolled
+            printf("Select planes N (%u)", X & 0x03);
+            break;
+
+        case 0x30:
+            // 0xFX30: Set I to the location of the 8x10 sprite for the digit in VX
+            printf("Set I to the location of the big sprite for the digit in V%X (0x%02X)",
+                X, record->vx);
+            break;
+
+        case 0x75:
+        case 0x85:
+            // 0xFX75 / 0xFX85: Store / load V0 to VX in the RPL user flags
+            printf("%s registers V0 to V%X %s the user flags",
+                NN == 0x75 ? "Dump" : "Load", X, NN == 0x75 ? "to" : "from");
+            break;
+
+        case 0x07:
+            // 0xFX07: Set VX to the value of the delay timer
+            printf("Set V%X to the value of the delay timer (0x%02X)",
+                X, record->delay_timer);
+            break;
+
+        case 0x0A:
+            // 0xFX0A: A key press is awaited, and then stored in VX (blocking operation)
+            printf("A key press is awaited, and then stored in V%X (blocking operation)",
+                X);
+            break;
+
+        case 0x15:
+            // 0xFX15: Set the delay timer to VX
+            printf("Set the delay timer (0x%02X) to V%X",
+                record->delay_timer, X);
+            break;
+
+        case 0x18:
+            // 0xFX18: Set the sound timer to VX
+            printf("Set the sound timer (0x%02X) to V%X",
+                record->sound_timer, X);
+            break;
+
+        case 0x29:
+            // 0xFX29: Set I to the location of the sprite for the character in VX.
+            //   Characters 0-F (in hexadecimal) are represented by a 4x5 font
+            printf("Set I to the location of the sprite for the character in V%X (0x%02X)",
+                X, record->vx);
+            break;
+
+        case 0x33:
+            // 0xFX33: Stores the BCD representation of VX,
+            //   with the hundreds digit in memory at location in I, the tens
+            //   digit at location I+1, and the ones digit at location I+2
+            printf("Stores the BCD representation of V%X in memory at location I (0x%02X)",
+                X, record->I);
+            break;
+
+        case 0x55:
+            // 0xFX55: Stores from V0 to VX (including VX) in memory, starting at address I.
+            printf("Dump registers from V0 to V%X at memory location I (0x%02X)",
+                X, record->I);
+            break;
+
+        case 0x65:
+            // 0xFX65: Stores from V0 to VX (including VX) in memory, starting at address I.
+            printf("Load registers from V0 to V%X from memory location I (0x%02X)",
+                X, record->I);
+            break;
+
+        case 0x1E:
+            // 0xFX1E: Add VX to I. VF is not affected
+            printf("Add V%X to I (0x%04X)", X, record->I);
+            break;
+
+        default:
+            printf("Not implemented or invalid opcode");
+            break; // Not implemented or invalid opcode
+        }
+        break;
+
+    default:
+        printf("Not implemented or bad opcode");
+        break; // Not implemented or invalid opcode
+    }
+}
+
+static void print_changes(const TraceRecord* record)
+{
+    // Registers and I that the step changed, loads of several registers
+    //  print every register they wrote
+    const uint8_t X = (record->opcode >> 8) & 0x0F;
+    uint8_t first;
+    const uint8_t loaded = trace_loaded_range(record->opcode, &first);
+
+    for (uint8_t i = 0; i < loaded; ++i) {
+        printf(" V%X=0x%02X", first + i, record->loaded[i]);
+    }
+
+    if (loaded == 0 && record->new_vx != record->vx && X != 0xF) {
+        printf(" V%X=0x%02X", X, record->new_vx);
+    }
+
+    // A load only changes VF when it wrote it
+    if (loaded == 0 && record->new_vf != record->vf) {
+        printf(" VF=0x%02X", record->new_vf);
+    }
+
+    if (record->new_I != record->I) {
+        printf(" I=0x%04X", record->new_I);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+    uint32_t last = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--last") == 0 && i + 1 < argc) {
+            last = strtoul(argv[++i], NULL, 10);
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (!path) {
+        fprintf(stderr, "Usage: chip8trace [--last <n>] <trace file>\n");
+        return EXIT_FAILURE;
+    }
+
+    static Trace trace;
+    uint64_t first_step;
+    uint32_t count;
+
+    if (!trace_init(&trace) || !trace_load(&trace, path, &first_step, &count)) {
+        trace_cleanup(&trace);
+        return EXIT_FAILURE;
+    }
+
+    const uint32_t start = last && last < count ? count - last : 0;
+
+    for (uint32_t i = start; i < count; ++i) {
+        const TraceRecord* record = &trace.records[i];
+
+        printf("%llu Address: 0x%04X, Opcode: 0x%04X Desc: ",
+            (unsigned long long)(first_step + i), record->pc, record->opcode);
+        print_description(record);
+
+        print_changes(record);
+        putchar('\n');
+    }
+
+    trace_cleanup(&trace);
+
+    return EXIT_SUCCESS;
+}